@@ -0,0 +1,519 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <iomanip>
+#include "colony.hpp"
+#include "config.hpp"
+#include "world.hpp"
+#include "bench_modes.hpp"
+#include "checkpoint.hpp"
+#include "trajectory.hpp"
+#include "domain.hpp"
+#include "profiler.hpp"
+#include "golden.hpp"
+
+
+void printUsage()
+{
+	std::cout << "Usage: antsim_bench [--ants N] [--ticks N] [--food N] [--dt SECONDS] [--threads N] [--seed N]" << std::endl;
+	std::cout << "                    [--direction angle|vector] [--render] [--load FILE] [--save FILE]" << std::endl;
+	std::cout << "                    [--record FILE] [--width PIXELS] [--height PIXELS] [--colonies N]" << std::endl;
+	std::cout << "                    [--processes N] [--profile FILE] [--digest-period N]" << std::endl;
+	std::cout << "                    [--golden-write FILE] [--golden-check FILE] [--cell-size PIXELS]" << std::endl;
+	std::cout << "                    [--coalesce PIXELS] [--field PIXELS] [--steering centroid|sensors]" << std::endl;
+	std::cout << "       antsim_bench --direction-bench" << std::endl;
+}
+
+
+bool parseArgs(int argc, char** argv, BenchConf& conf)
+{
+	for (int i(1); i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--direction-bench") {
+			conf.direction_bench = true;
+			continue;
+		}
+		if (arg == "--render") {
+			conf.render = true;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			printUsage();
+			return false;
+		}
+
+		const char* value = argv[++i];
+		if (arg == "--ants") {
+			conf.ants_count = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--ticks") {
+			conf.ticks = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--food") {
+			conf.food_spots = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--dt") {
+			conf.dt = std::strtof(value, nullptr);
+		}
+		else if (arg == "--threads") {
+			conf.threads = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--seed") {
+			conf.seed = std::strtoull(value, nullptr, 10);
+		}
+		else if (arg == "--direction") {
+			conf.direction_mode = std::string(value) == "angle" ? Directions::Angle : Directions::Vector;
+		}
+		else if (arg == "--load") {
+			conf.load_path = value;
+		}
+		else if (arg == "--save") {
+			conf.save_path = value;
+		}
+		else if (arg == "--record") {
+			conf.record_path = value;
+		}
+		else if (arg == "--width") {
+			conf.world_width = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--height") {
+			conf.world_height = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--colonies") {
+			conf.colonies = std::max(1u, to<uint32_t>(std::strtoul(value, nullptr, 10)));
+		}
+		else if (arg == "--profile") {
+			conf.profile_path = value;
+		}
+		else if (arg == "--cell-size") {
+			conf.marker_cell_size = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--coalesce") {
+			conf.coalesce_radius = std::strtof(value, nullptr);
+		}
+		else if (arg == "--steering") {
+			conf.steering = std::string(value) == "sensors" ? AntParameters::Sensors : AntParameters::Centroid;
+		}
+		else if (arg == "--field") {
+			conf.field_texel_size = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--digest-period") {
+			conf.digest_period = std::max(1u, to<uint32_t>(std::strtoul(value, nullptr, 10)));
+		}
+		else if (arg == "--golden-write") {
+			conf.golden_write_path = value;
+		}
+		else if (arg == "--golden-check") {
+			conf.golden_check_path = value;
+		}
+		else if (arg == "--processes") {
+			conf.processes = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else {
+			printUsage();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// Food piles on a ring around the center so that trails actually form
+void addFood(World& world, const sf::Vector2f& center, uint32_t spots)
+{
+	const float ring_radius = 350.0f;
+	for (uint32_t i(0); i < spots; ++i) {
+		const float angle = 2.0f * PI * to<float>(i) / to<float>(spots);
+		const sf::Vector2f spot = center + ring_radius * sf::Vector2f(cos(angle), sin(angle));
+		for (int32_t x(-3); x < 4; ++x) {
+			for (int32_t y(-3); y < 4; ++y) {
+				world.addFoodAt(spot.x + 4.0f * x, spot.y + 4.0f * y, 5.0f);
+			}
+		}
+	}
+}
+
+
+// Digests of a run every digest_period ticks, written to a golden file or checked against one
+// as they are taken
+class GoldenRun
+{
+public:
+	// A checked run takes its scenario from the golden file
+	bool open(BenchConf& conf)
+	{
+		m_conf = conf;
+		if (!isActive()) {
+			return true;
+		}
+		if (!conf.load_path.empty()) {
+			std::cout << "Golden runs start from a new world, --load cannot be used" << std::endl;
+			return false;
+		}
+		if (!conf.golden_check_path.empty() && !golden::read(conf.golden_check_path, conf, m_expected)) {
+			std::cout << "Cannot read golden file '" << conf.golden_check_path << "'" << std::endl;
+			return false;
+		}
+		m_conf = conf;
+		return true;
+	}
+
+	bool isActive() const
+	{
+		return !m_conf.golden_write_path.empty() || !m_conf.golden_check_path.empty();
+	}
+
+	// Returns false at the first digest differing from the golden file
+	bool record(const World& world, const std::vector<Colony>& colonies)
+	{
+		if (!isActive() || world.tick % m_conf.digest_period) {
+			return true;
+		}
+
+		m_digests.push_back(golden::compute(world, colonies));
+		if (m_conf.golden_check_path.empty()) {
+			return true;
+		}
+		const uint64_t index = m_digests.size() - 1;
+		const std::string diverged = index < m_expected.size() ? golden::getDiverged(m_expected[index], m_digests.back()) : "tick";
+		if (!diverged.empty()) {
+			std::cout << "golden_check  diverged at tick " << world.tick << ": " << diverged << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Also checks the digests kept by the world against the grids. Returns the exit code
+	int finish(const World& world)
+	{
+		if (!isActive()) {
+			return 0;
+		}
+		if (world.markers_digest != world.computeMarkersDigest() || world.food_digest != world.computeFoodDigest()) {
+			std::cout << "digest_error  the digests kept by the world differ from the grids" << std::endl;
+			return 1;
+		}
+		std::cout << "digests       " << m_digests.size() << std::endl;
+
+		if (!m_conf.golden_write_path.empty() && !golden::write(m_conf.golden_write_path, m_conf, m_digests)) {
+			std::cout << "Cannot write golden file '" << m_conf.golden_write_path << "'" << std::endl;
+			return 1;
+		}
+		if (!m_conf.golden_check_path.empty()) {
+			if (m_digests.size() != m_expected.size()) {
+				std::cout << "golden_check  " << m_digests.size() << " digests taken, " << m_expected.size() << " expected" << std::endl;
+				return 1;
+			}
+			std::cout << "golden_check  passed" << std::endl;
+		}
+		return 0;
+	}
+
+private:
+	BenchConf m_conf;
+	std::vector<golden::Digest> m_expected;
+	std::vector<golden::Digest> m_digests;
+};
+
+
+bool saveCheckpoint(const BenchConf& conf, const World& world, const std::vector<Colony>& colonies)
+{
+	if (conf.save_path.empty()) {
+		return true;
+	}
+
+	const auto save_start = std::chrono::steady_clock::now();
+	if (!checkpoint::save(conf.save_path, world, colonies)) {
+		std::cout << "Cannot write checkpoint '" << conf.save_path << "'" << std::endl;
+		return false;
+	}
+	std::cout << "save_ms       " << std::chrono::duration<double>(std::chrono::steady_clock::now() - save_start).count() * 1e3 << std::endl;
+	return true;
+}
+
+
+// The same run split over worker processes, only the final state comes back from them
+int runProcesses(const BenchConf& conf, World& world, std::vector<Colony>& colonies, GoldenRun& golden_run)
+{
+	if (conf.render || !conf.record_path.empty()) {
+		std::cout << "--render and --record cannot be used with --processes" << std::endl;
+		return 1;
+	}
+
+	// Golden runs come back from the workers at every digest
+	const uint32_t ticks_per_run = golden_run.isActive() ? conf.digest_period : std::max(conf.ticks, 1u);
+	domain::Stats stats;
+	const auto start = std::chrono::steady_clock::now();
+	if (!golden_run.record(world, colonies)) {
+		return 1;
+	}
+	for (uint32_t done(0); done < conf.ticks;) {
+		const uint32_t ticks = std::min(ticks_per_run - world.tick % ticks_per_run, conf.ticks - done);
+		if (!domain::run(world, colonies, conf.processes, ticks, conf.dt, conf.threads, &stats)) {
+			std::cout << "Cannot run over " << conf.processes << " processes, strips have to be at least "
+				<< 2 * domain::getGhostColumns(world, colonies) << " marker cells wide and marker cells a multiple of "
+				<< World::food_cell_size << " pixels" << std::endl;
+			return 1;
+		}
+		done += ticks;
+		if (!golden_run.record(world, colonies)) {
+			return 1;
+		}
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "ants          " << conf.ants_count << std::endl;
+	std::cout << "colonies      " << colonies.size() << std::endl;
+	std::cout << "ticks         " << conf.ticks << std::endl;
+	std::cout << "processes     " << conf.processes << std::endl;
+	std::cout << "elapsed_s     " << elapsed << std::endl;
+	std::cout << "ticks_per_sec " << conf.ticks / elapsed << std::endl;
+	std::cout << "ns_per_ant    " << elapsed * 1e9 / (to<double>(conf.ticks) * std::max(conf.ants_count, 1u)) << std::endl;
+	std::cout << "final_markers " << world.markers_count << std::endl;
+	std::cout << "migrated/tick " << to<double>(stats.migrated_ants) / std::max(conf.ticks, 1u) << std::endl;
+	std::cout << "exchanged/tick " << to<double>(stats.exchanged_bytes) / std::max(conf.ticks, 1u) << std::endl;
+
+	if (golden_run.finish(world)) {
+		return 1;
+	}
+	return saveCheckpoint(conf, world, colonies) ? 0 : 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	BenchConf conf;
+	if (!parseArgs(argc, argv, conf)) {
+		return 1;
+	}
+
+	if (conf.direction_bench) {
+		return runDirectionBench();
+	}
+
+	if (!conf.marker_cell_size) {
+		conf.marker_cell_size = World::default_marker_cell_size;
+	}
+	GoldenRun golden_run;
+	if (!golden_run.open(conf)) {
+		return 1;
+	}
+	// Neither worker processes nor checkpoints know about the field
+	if (conf.field_texel_size && (conf.processes || !conf.load_path.empty())) {
+		std::cout << "--field cannot be used with --processes or --load" << std::endl;
+		return 1;
+	}
+
+	AntParameters ant_parameters;
+	ant_parameters.direction_mode = conf.direction_mode;
+
+	checkpoint::Reader reader;
+	const auto load_start = std::chrono::steady_clock::now();
+	if (!conf.load_path.empty() && !reader.open(conf.load_path)) {
+		std::cout << "Cannot read checkpoint '" << conf.load_path << "'" << std::endl;
+		return 1;
+	}
+
+	if (!conf.load_path.empty()) {
+		conf.world_width = to<uint32_t>(reader.getHeader().world_width);
+		conf.world_height = to<uint32_t>(reader.getHeader().world_height);
+		conf.colonies = reader.getHeader().colonies_count;
+		conf.marker_cell_size = reader.getHeader().marker_cell_size;
+	}
+	World world(conf.world_width, conf.world_height, conf.colonies, conf.marker_cell_size);
+	world.coalesce_radius = conf.coalesce_radius;
+	if (conf.field_texel_size) {
+		world.useField(conf.field_texel_size);
+	}
+	const sf::Vector2f center(to<float>(conf.world_width / 2), to<float>(conf.world_height / 2));
+	// Nests between the center and the food ring
+	const float nests_radius = 175.0f;
+	std::vector<Colony> colonies = conf.load_path.empty() ? makeColonies(conf.colonies, conf.ants_count, center, nests_radius, conf.seed, ant_parameters) : reader.makeColonies();
+	if (conf.load_path.empty()) {
+		for (const Colony& colony : colonies) {
+			world.addMarker(Marker(colony.position, Marker::ToHome, 10.0f, true, colony.id));
+		}
+		addFood(world, center, conf.food_spots);
+	}
+	else {
+		if (!reader.restore(world, colonies)) {
+			std::cout << "Checkpoint '" << conf.load_path << "' does not match the world" << std::endl;
+			return 1;
+		}
+		conf.ants_count = 0;
+		for (const Colony& colony : colonies) {
+			conf.ants_count += to<uint32_t>(colony.ants.size());
+			if (colony.ants.parameters.steering == AntParameters::Sensors) {
+				conf.steering = AntParameters::Sensors;
+			}
+		}
+		const double load_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+		std::cout << "load_ms       " << load_time * 1e3 << std::endl;
+	}
+	// Checkpoints keep their steering, --steering sensors switches their colonies too
+	if (conf.steering == AntParameters::Sensors) {
+		world.useMarkerRaster();
+		for (Colony& colony : colonies) {
+			colony.ants.parameters.steering = AntParameters::Sensors;
+		}
+	}
+	// Before any thread is started, see domain::run
+	if (conf.processes) {
+		return runProcesses(conf, world, colonies, golden_run);
+	}
+	ThreadPool thread_pool(conf.threads);
+
+	trajectory::Recorder recorder;
+	// Only the first colony is recorded
+	if (!conf.record_path.empty() && !recorder.open(conf.record_path, world, colonies.front())) {
+		std::cout << "Cannot write trajectories '" << conf.record_path << "'" << std::endl;
+		return 1;
+	}
+
+	// Offscreen target, works without a display on Mesa's llvmpipe
+	std::unique_ptr<sf::RenderTexture> render_texture;
+	if (conf.render) {
+		Conf::loadTextures();
+		render_texture.reset(new sf::RenderTexture());
+		if (!render_texture->create(Conf::WIN_WIDTH, Conf::WIN_HEIGHT)) {
+			std::cout << "Cannot create the offscreen render target" << std::endl;
+			return 1;
+		}
+	}
+
+	// Centered on the first colony whatever the world size
+	sf::RenderStates render_states;
+	render_states.transform.translate(sf::Vector2f(to<float>(Conf::WIN_WIDTH / 2), to<float>(Conf::WIN_HEIGHT / 2)) - colonies.front().position);
+
+	uint64_t peak_markers = 0;
+	uint64_t expirations = 0;
+	uint64_t examined_markers = 0;
+	uint64_t marker_queries = 0;
+	uint64_t uploaded_vertices = 0;
+	double render_time = 0.0;
+
+	// Timers only run when profiling so that the default figures stay comparable
+	Profiler profiler(std::max(conf.ticks, 1u));
+	const bool profile = !conf.profile_path.empty();
+	if (profile && !profiler.openCsv(conf.profile_path)) {
+		std::cout << "Cannot write profile '" << conf.profile_path << "'" << std::endl;
+		return 1;
+	}
+
+	if (!golden_run.record(world, colonies)) {
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t i(0); i < conf.ticks; ++i) {
+		PhaseTimes tick_times;
+		tick_times.ticks = 1;
+		PhaseTimes* times = profile ? &tick_times : nullptr;
+		Colony::updateAll(colonies, conf.dt, world, thread_pool, times);
+		for (const Colony& colony : colonies) {
+			for (const Colony::UpdateChunk& chunk : colony.chunks) {
+				examined_markers += chunk.changes.examined_markers;
+				marker_queries += chunk.changes.marker_queries;
+			}
+		}
+		world.update(conf.dt, times, &thread_pool);
+		peak_markers = std::max(peak_markers, world.markers_count);
+		expirations += world.expired_markers + world.expired_food;
+		if (!conf.record_path.empty()) {
+			recorder.record(colonies.front().ants, world.tick);
+		}
+		if (!golden_run.record(world, colonies)) {
+			return 1;
+		}
+
+		if (render_texture) {
+			const auto render_start = std::chrono::steady_clock::now();
+			{
+				ScopedTimer timer(times, PhaseTimes::Draw);
+				render_texture->clear(sf::Color(94, 87, 87));
+				world.render(*render_texture, render_states);
+				for (const Colony& colony : colonies) {
+					colony.render(*render_texture, render_states);
+				}
+			}
+			{
+				ScopedTimer timer(times, PhaseTimes::Display);
+				render_texture->display();
+			}
+			render_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+			uploaded_vertices += world.marker_buffer.uploaded_vertices;
+		}
+
+		if (profile) {
+			tick_times.ms[PhaseTimes::Frame] = std::accumulate(tick_times.ms, tick_times.ms + PhaseTimes::Frame, 0.0f);
+			profiler.addFrame(tick_times);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	const double elapsed = std::chrono::duration<double>(end - start).count();
+	const double ticks_per_sec = conf.ticks / elapsed;
+	const double ns_per_ant_tick = elapsed * 1e9 / (to<double>(conf.ticks) * std::max(conf.ants_count, 1u));
+
+	std::cout << "ants          " << conf.ants_count << std::endl;
+	std::cout << "colonies      " << colonies.size() << std::endl;
+	std::cout << "ticks         " << conf.ticks << std::endl;
+	std::cout << "threads       " << thread_pool.getThreadsCount() << std::endl;
+	std::cout << "elapsed_s     " << elapsed << std::endl;
+	std::cout << "ticks_per_sec " << ticks_per_sec << std::endl;
+	std::cout << "ns_per_ant    " << ns_per_ant_tick << std::endl;
+	std::cout << "peak_markers  " << peak_markers << std::endl;
+	uint64_t grid_chunks = world.grid_food.chunks.size();
+	for (const Grid<Marker>& grid : world.marker_grids) {
+		grid_chunks += grid.chunks.size();
+	}
+	std::cout << "grid_chunks   " << grid_chunks << std::endl;
+	std::cout << "expired/tick  " << to<double>(expirations) / std::max(conf.ticks, 1u) << std::endl;
+	std::cout << "marker_cell   " << world.marker_grids.front().cell_size << std::endl;
+	std::cout << "backend       " << (world.field ? "field" : "markers") << std::endl;
+	std::cout << "steering      " << (conf.steering == AntParameters::Sensors ? "sensors" : "centroid") << std::endl;
+	if (world.field) {
+		std::cout << "field_texel   " << world.field->texel_size << std::endl;
+		std::cout << "field_texels  " << world.field->getTexelsCount() << std::endl;
+	}
+	std::cout << "examined/query " << to<double>(examined_markers) / std::max(marker_queries, uint64_t(1)) << std::endl;
+	// At the end of the run, walking all the cells every tick would distort the timings
+	std::cout << "markers_mb    " << to<double>(world.getMarkersMemory()) / (1 << 20) << std::endl;
+	std::cout << "food_occupancy_kb " << to<double>(world.food_occupancy.getMemory()) / (1 << 10) << std::endl;
+	if (conf.coalesce_radius > 0.0f) {
+		std::cout << "coalesced/tick " << to<double>(world.coalesced_markers) / std::max(conf.ticks, 1u) << std::endl;
+	}
+	if (render_texture) {
+		std::cout << "render_ms     " << render_time * 1e3 / std::max(conf.ticks, 1u) << std::endl;
+		std::cout << "uploaded/tick " << to<double>(uploaded_vertices) / std::max(conf.ticks, 1u) << std::endl;
+		Conf::freeTextures();
+	}
+
+	if (profile) {
+		std::cout << "phase              p50_ms   p95_ms   p99_ms" << std::endl;
+		for (uint32_t i(0); i < PhaseTimes::PhasesCount; ++i) {
+			const PhaseTimes::Phase phase = static_cast<PhaseTimes::Phase>(i);
+			std::cout << std::left << std::setw(18) << PhaseTimes::getName(phase) << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(9) << profiler.getPercentile(phase, 0.5f) << std::setw(9) << profiler.getPercentile(phase, 0.95f)
+				<< std::setw(9) << profiler.getPercentile(phase, 0.99f) << std::endl;
+		}
+		std::cout.unsetf(std::ios::floatfield);
+	}
+
+	if (!conf.record_path.empty()) {
+		recorder.close();
+		std::cout << "record_bytes  " << recorder.getWrittenBytes() << std::endl;
+		std::cout << "bytes/ant     " << to<double>(recorder.getWrittenBytes()) / (to<double>(conf.ticks) * std::max(conf.ants_count, 1u)) << std::endl;
+		std::cout << "dropped       " << recorder.getDroppedChunks() << std::endl;
+	}
+
+	if (golden_run.finish(world)) {
+		return 1;
+	}
+	return saveCheckpoint(conf, world, colonies) ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "config.hpp"
+#include "direction.hpp"
+#include "ant.hpp"
+
+
+// Scenario and options of a bench run
+struct BenchConf
+{
+	uint32_t ants_count = 10000;
+	uint32_t ticks = 1000;
+	uint32_t food_spots = 8;
+	uint32_t threads = 0;
+	uint32_t colonies = 1;
+	// Worker processes sharing the world by strips, 0 runs everything in this process
+	uint32_t processes = 0;
+	uint32_t world_width = Conf::WIN_WIDTH;
+	uint32_t world_height = Conf::WIN_HEIGHT;
+	// Side of the marker cells in pixels, 0 keeps the default of World
+	uint32_t marker_cell_size = 0;
+	// Deposits closer than that to a marker of their cell are merged into it, 0 never merges
+	float coalesce_radius = 0.0f;
+	// Texel size of the pheromone field replacing fading markers, 0 keeps discrete markers
+	uint32_t field_texel_size = 0;
+	uint64_t seed = 0;
+	float dt = 0.016f;
+	Directions::Mode direction_mode = Directions::Angle;
+	AntParameters::Steering steering = AntParameters::Centroid;
+	bool direction_bench = false;
+	bool render = false;
+	// Checkpoint to start from instead of a new colony, and checkpoint written at the end
+	std::string load_path;
+	std::string save_path;
+	// Trajectories file written during the run
+	std::string record_path;
+	// Phase times of every tick, as CSV
+	std::string profile_path;
+	// Digests of the state every digest_period ticks, written to or checked against a golden file
+	uint32_t digest_period = 10;
+	std::string golden_write_path;
+	std::string golden_check_path;
+};
+
+
+// Accuracy and speed of the trigonometry free direction code against libm
+int runDirectionBench();
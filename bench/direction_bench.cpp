@@ -0,0 +1,128 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include "direction.hpp"
+#include "counter_rng.hpp"
+#include "bench_modes.hpp"
+
+
+namespace
+{
+
+template<typename Callback>
+double timeIt(uint32_t repeats, Callback&& callback)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t r(0); r < repeats; ++r) {
+		callback(r);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+}
+
+}
+
+
+int runDirectionBench()
+{
+	// simd::sinCos against double precision libm
+	double max_error = 0.0;
+	for (double x(-1000.0); x < 1000.0; x += 0.000731) {
+		const float xf = static_cast<float>(x);
+		float s, c;
+		simd::sinCos<simd::Scalar>(xf, s, c);
+		max_error = std::max(max_error, std::abs(s - std::sin(static_cast<double>(xf))));
+		max_error = std::max(max_error, std::abs(c - std::cos(static_cast<double>(xf))));
+	}
+
+	// Small enough to stay in cache, the cost measured is the computation
+	const uint32_t count = 1 << 14;
+	const CounterRNG rng(1);
+	std::vector<float> angles(count), out_sin(count), out_cos(count);
+	for (uint32_t i(0); i < count; ++i) {
+		angles[i] = rng.getRange(4.0f * PI, i, 0, CounterRNG::InitAngle);
+	}
+
+	// The offset and the checksum keep the compiler from skipping repeats
+	float libm_check = 0.0f;
+	const double libm_time = timeIt(500, [&](uint32_t r) {
+		const float offset = 0.001f * r;
+		for (uint32_t i(0); i < count; ++i) {
+			out_sin[i] = std::sin(angles[i] + offset);
+			out_cos[i] = std::cos(angles[i] + offset);
+		}
+		libm_check += out_sin[r % count] + out_cos[r % count];
+	});
+
+	float simd_check = 0.0f;
+	const double simd_time = timeIt(500, [&](uint32_t r) {
+		const float offset = 0.001f * r;
+		simd::forEachPack(0, angles.size(), [&](auto pack, uint64_t i) {
+			using V = decltype(pack);
+			typename V::Float s, c;
+			simd::sinCos<V>(V::add(V::load(&angles[i]), V::set(offset)), s, c);
+			V::store(&out_sin[i], s);
+			V::store(&out_cos[i], c);
+		});
+		simd_check += out_sin[r % count] + out_cos[r % count];
+	});
+
+	// Easing in both modes toward the same targets, changed every 8 ticks like the ants do
+	const uint32_t headings = 1 << 16;
+	const uint32_t ticks = 1000;
+	const float dt = 0.016f;
+	Directions angle_mode(10.0f, Directions::Angle);
+	Directions vector_mode(10.0f, Directions::Vector);
+	for (uint32_t i(0); i < headings; ++i) {
+		const float a = rng.getRange(PI, i, 0, CounterRNG::InitAngle);
+		angle_mode.add(a);
+		vector_mode.add(a);
+	}
+
+	double angle_time = 0.0;
+	double vector_time = 0.0;
+	double max_heading_error = 0.0;
+	for (uint32_t t(0); t < ticks; ++t) {
+		if (t % 8 == 0) {
+			for (uint32_t i(0); i < headings; ++i) {
+				const float noise = rng.getRange(PI * 0.1f, i, t, CounterRNG::DirectionNoise);
+				angle_mode.addTarget(i, noise);
+				vector_mode.addTarget(i, noise);
+			}
+		}
+		angle_time += timeIt(1, [&](uint32_t) { angle_mode.update(0, headings, dt); });
+		vector_time += timeIt(1, [&](uint32_t) { vector_mode.update(0, headings, dt); });
+	}
+
+	// Angle mode vectors lag one easing step behind, bring them up to date before comparing
+	for (uint32_t i(0); i < headings; ++i) {
+		const double a = angle_mode.angle[i];
+		const double error = std::abs(std::remainder(a - std::atan2(vector_mode.vec_y[i], vector_mode.vec_x[i]), 2.0 * 3.14159265358979));
+		const double length_error = std::abs(1.0 - std::hypot(vector_mode.vec_x[i], vector_mode.vec_y[i]));
+		max_heading_error = std::max(max_heading_error, std::max(error, length_error));
+	}
+
+	// Half turns, as ants do when they pick food or get home: both modes have to face their
+	// rotated target
+	double max_add_now_error = 0.0;
+	for (uint32_t i(0); i < headings; ++i) {
+		angle_mode.addNow(i, PI);
+		vector_mode.addNow(i, PI);
+		const double error_x = std::abs(angle_mode.vec_x[i] - vector_mode.vec_x[i]);
+		const double error_y = std::abs(angle_mode.vec_y[i] - vector_mode.vec_y[i]);
+		const double target_error = std::abs(vector_mode.vec_x[i] - vector_mode.target_x[i]) + std::abs(vector_mode.vec_y[i] - vector_mode.target_y[i]);
+		max_add_now_error = std::max(max_add_now_error, std::max(std::max(error_x, error_y), target_error));
+	}
+
+	std::cout << "sincos_max_abs_error   " << max_error << std::endl;
+	std::cout << "libm_sincos_ns         " << libm_time * 1e9 / count << std::endl;
+	std::cout << "simd_sincos_ns         " << simd_time * 1e9 / count << std::endl;
+	std::cout << "sincos_speedup         " << libm_time / simd_time << std::endl;
+	std::cout << "checksums              " << libm_check << " " << simd_check << std::endl;
+	std::cout << "angle_mode_ease_ns     " << angle_time * 1e9 / (to<double>(ticks) * headings) << std::endl;
+	std::cout << "vector_mode_ease_ns    " << vector_time * 1e9 / (to<double>(ticks) * headings) << std::endl;
+	std::cout << "vector_mode_max_error  " << max_heading_error << " (rad or unit length, after " << ticks << " ticks)" << std::endl;
+	std::cout << "add_now_max_error      " << max_add_now_error << " (unit vector components, after a half turn)" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include "golden.hpp"
+#include <fstream>
+#include <iomanip>
+
+
+namespace golden
+{
+
+namespace
+{
+
+const char* const magic = "antsim-golden";
+constexpr uint32_t version = 1;
+
+}
+
+
+Digest compute(const World& world, const std::vector<Colony>& colonies)
+{
+	Digest digest;
+	digest.tick = world.tick;
+	digest.ants = 0;
+	for (const Colony& colony : colonies) {
+		digest.ants += colony.getDigest();
+	}
+	digest.markers = world.markers_digest + (world.field ? world.field->getDigest() : 0);
+	digest.food = world.food_digest;
+	return digest;
+}
+
+
+std::string getDiverged(const Digest& expected, const Digest& actual)
+{
+	std::string diverged;
+	auto check = [&](bool same, const char* part) {
+		if (!same) {
+			diverged += diverged.empty() ? part : std::string(" ") + part;
+		}
+	};
+	check(expected.tick == actual.tick, "tick");
+	check(expected.ants == actual.ants, "ants");
+	check(expected.markers == actual.markers, "markers");
+	check(expected.food == actual.food, "food");
+	return diverged;
+}
+
+
+bool write(const std::string& path, const BenchConf& conf, const std::vector<Digest>& digests)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	file << magic << " " << version << "\n";
+	file << "ants " << conf.ants_count << "\n";
+	file << "colonies " << conf.colonies << "\n";
+	file << "food " << conf.food_spots << "\n";
+	file << "seed " << conf.seed << "\n";
+	file << "dt " << std::setprecision(9) << conf.dt << "\n";
+	file << "width " << conf.world_width << "\n";
+	file << "height " << conf.world_height << "\n";
+	file << "cell " << conf.marker_cell_size << "\n";
+	file << "coalesce " << conf.coalesce_radius << "\n";
+	file << "field " << conf.field_texel_size << "\n";
+	file << "direction " << (conf.direction_mode == Directions::Angle ? "angle" : "vector") << "\n";
+	file << "steering " << (conf.steering == AntParameters::Sensors ? "sensors" : "centroid") << "\n";
+	file << "ticks " << conf.ticks << "\n";
+	file << "period " << conf.digest_period << "\n";
+	file << "digests " << digests.size() << "\n";
+	file << std::hex << std::setfill('0');
+	for (const Digest& d : digests) {
+		file << std::dec << d.tick << std::hex << " " << std::setw(16) << d.ants << " " << std::setw(16) << d.markers
+			<< " " << std::setw(16) << d.food << "\n";
+	}
+	return static_cast<bool>(file);
+}
+
+
+bool read(const std::string& path, BenchConf& conf, std::vector<Digest>& digests)
+{
+	std::ifstream file(path);
+	std::string word;
+	uint32_t file_version = 0;
+	if (!(file >> word >> file_version) || word != magic || file_version != version) {
+		return false;
+	}
+
+	uint64_t digests_count = 0;
+	while (file >> word) {
+		if (word == "ants") {
+			file >> conf.ants_count;
+		}
+		else if (word == "colonies") {
+			file >> conf.colonies;
+		}
+		else if (word == "food") {
+			file >> conf.food_spots;
+		}
+		else if (word == "seed") {
+			file >> conf.seed;
+		}
+		else if (word == "dt") {
+			file >> conf.dt;
+		}
+		else if (word == "width") {
+			file >> conf.world_width;
+		}
+		else if (word == "height") {
+			file >> conf.world_height;
+		}
+		else if (word == "cell") {
+			file >> conf.marker_cell_size;
+		}
+		else if (word == "coalesce") {
+			file >> conf.coalesce_radius;
+		}
+		else if (word == "field") {
+			file >> conf.field_texel_size;
+		}
+		else if (word == "direction") {
+			file >> word;
+			conf.direction_mode = word == "angle" ? Directions::Angle : Directions::Vector;
+		}
+		else if (word == "steering") {
+			file >> word;
+			conf.steering = word == "sensors" ? AntParameters::Sensors : AntParameters::Centroid;
+		}
+		else if (word == "ticks") {
+			file >> conf.ticks;
+		}
+		else if (word == "period") {
+			file >> conf.digest_period;
+		}
+		else if (word == "digests") {
+			file >> digests_count;
+			break;
+		}
+		else {
+			return false;
+		}
+	}
+
+	digests.clear();
+	for (uint64_t i(0); i < digests_count; ++i) {
+		Digest d;
+		if (!(file >> std::dec >> d.tick >> std::hex >> d.ants >> d.markers >> d.food)) {
+			return false;
+		}
+		digests.push_back(d);
+	}
+	return static_cast<bool>(file) && conf.digest_period;
+}
+
+}
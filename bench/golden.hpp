@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "world.hpp"
+#include "colony.hpp"
+#include "bench_modes.hpp"
+
+
+// Digest stream of a seeded bench run. A golden file is a text file holding the scenario of a
+// run and the digests of its state every digest_period ticks, a run of the same scenario is
+// checked against it digest by digest
+namespace golden
+{
+
+struct Digest
+{
+	uint32_t tick;
+	uint64_t ants;
+	uint64_t markers;
+	uint64_t food;
+};
+
+// The markers digest also covers the pheromone field
+Digest compute(const World& world, const std::vector<Colony>& colonies);
+
+// Parts of the state whose digests differ, separated by spaces, empty when none does
+std::string getDiverged(const Digest& expected, const Digest& actual);
+
+bool write(const std::string& path, const BenchConf& conf, const std::vector<Digest>& digests);
+
+// Sets the scenario of conf from the file: world, marker cells, coalescing, pheromone field, steering, colonies, food, seed, time step and ticks
+bool read(const std::string& path, BenchConf& conf, std::vector<Digest>& digests);
+
+}
@@ -0,0 +1,575 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include "world.hpp"
+#include "ant.hpp"
+#include "counter_rng.hpp"
+
+
+// Timings of the hot primitives in isolation, over ant counts and marker densities. Results are
+// written as JSON, one result per line, and two result files can be compared with --compare
+struct MicroConf
+{
+	std::vector<uint32_t> ants_counts = {1000, 10000, 100000};
+	// Markers per density_side x density_side square of each marker grid
+	std::vector<uint32_t> densities = {1, 16, 128};
+	uint32_t samples = 7;
+	uint64_t seed = 0;
+	// Only the benchmarks whose name contains it are run
+	std::string filter;
+	std::string output_path;
+	std::string baseline_path;
+	std::string candidate_path;
+	// Relative change of the median above which --compare reports a difference
+	double threshold = 0.05;
+};
+
+
+struct Result
+{
+	std::string name;
+	uint32_t ants = 0;
+	uint32_t density = 0;
+	uint32_t iterations = 0;
+	// Nanoseconds per operation over the samples
+	double median_ns = 0.0;
+	double min_ns = 0.0;
+	double max_ns = 0.0;
+};
+
+
+namespace
+{
+
+// Checksums of the benchmarks end up here so that nothing measured can be optimized away
+volatile uint64_t sink = 0;
+
+const uint32_t world_width = Conf::WIN_WIDTH;
+const uint32_t world_height = Conf::WIN_HEIGHT;
+
+// A sample lasts at least that long, short benchmarks are repeated within a sample
+const double min_sample_time = 0.005;
+
+// Densities do not depend on the cell size of the grids, so that grids can be compared
+const int32_t density_side = 45;
+
+
+std::vector<uint32_t> parseList(const char* value)
+{
+	std::vector<uint32_t> list;
+	std::stringstream stream(value);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		list.push_back(to<uint32_t>(std::strtoul(item.c_str(), nullptr, 10)));
+	}
+	return list;
+}
+
+
+// Position drawn uniformly in the rectangle of origin and size, k selects an independent draw
+sf::Vector2f getRandomPosition(const CounterRNG& rng, uint32_t i, uint32_t k, const sf::Vector2f& origin, const sf::Vector2f& size)
+{
+	return origin + sf::Vector2f(rng.getUnder(size.x, i, 2 * k, CounterRNG::InitAngle), rng.getUnder(size.y, i, 2 * k + 1, CounterRNG::InitAngle));
+}
+
+
+// Calls add with density positions in every side x side square of the world
+template<typename Add>
+void fillSquares(int32_t side, uint32_t density, const CounterRNG& rng, Add&& add)
+{
+	const sf::Vector2f square_size(to<float>(side), to<float>(side));
+	uint32_t n = 0;
+	for (int32_t y(0); y < to<int32_t>(world_height) / side; ++y) {
+		for (int32_t x(0); x < to<int32_t>(world_width) / side; ++x) {
+			const sf::Vector2f origin(to<float>(x * side), to<float>(y * side));
+			for (uint32_t i(0); i < density; ++i) {
+				add(getRandomPosition(rng, n++, 0, origin, square_size));
+			}
+		}
+	}
+}
+
+
+// Markers of both channels of the first colony, alive for at most 10 / decay_per_tick ticks
+void fillWorld(World& world, uint32_t density, const CounterRNG& rng)
+{
+	uint32_t n = 0;
+	for (Marker::Type type : {Marker::ToHome, Marker::ToFood}) {
+		world.getGrid(0, type).reserveStencilRadius(AntParameters().marker_detection_max_dist);
+		fillSquares(density_side, density, rng, [&](const sf::Vector2f& position) {
+			world.addMarker(Marker(position, type, 10.0f * (1.0f - rng.getUnit(n++, 0, CounterRNG::InitMarkerTimer)), false, 0));
+		});
+	}
+}
+
+
+Ants makeAnts(uint32_t count, const CounterRNG& rng)
+{
+	Ants ants{AntParameters()};
+	ants.reserveCapacity(count);
+	const sf::Vector2f world_size(to<float>(world_width), to<float>(world_height));
+	for (uint32_t i(0); i < count; ++i) {
+		const sf::Vector2f position = getRandomPosition(rng, i, 1, sf::Vector2f(0.0f, 0.0f), world_size);
+		ants.add(position.x, position.y, i, rng);
+		ants.phase[i] = to<uint8_t>(i % 2 ? Marker::ToHome : Marker::ToFood);
+	}
+	return ants;
+}
+
+
+// Calls setup then run for each iteration and only times run, which returns the number of
+// operations it did. The number of iterations per sample is chosen from a first call
+template<typename Setup, typename Run>
+Result measure(const MicroConf& conf, const std::string& name, uint32_t ants, uint32_t density, Setup&& setup, Run&& run)
+{
+	Result result;
+	result.name = name;
+	result.ants = ants;
+	result.density = density;
+
+	auto timeIteration = [&](uint64_t& ops) {
+		setup();
+		const auto start = std::chrono::steady_clock::now();
+		ops += run();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	uint64_t warmup_ops = 0;
+	const double warmup_time = timeIteration(warmup_ops);
+	result.iterations = to<uint32_t>(std::min(1000.0, std::max(1.0, min_sample_time / std::max(warmup_time, 1e-9))));
+
+	std::vector<double> samples;
+	for (uint32_t s(0); s < std::max(conf.samples, 1u); ++s) {
+		double time = 0.0;
+		uint64_t ops = 0;
+		for (uint32_t i(0); i < result.iterations; ++i) {
+			time += timeIteration(ops);
+		}
+		samples.push_back(time * 1e9 / to<double>(std::max(ops, uint64_t(1))));
+	}
+
+	std::sort(samples.begin(), samples.end());
+	result.median_ns = samples[samples.size() / 2];
+	result.min_ns = samples.front();
+	result.max_ns = samples.back();
+	std::cerr << name << " ants=" << ants << " density=" << density << " " << result.median_ns << " ns" << std::endl;
+	return result;
+}
+
+
+bool isSelected(const MicroConf& conf, const std::string& name)
+{
+	return conf.filter.empty() || name.find(conf.filter) != std::string::npos;
+}
+
+
+// The 3x3 cells around random positions
+void benchGetAllAt(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	std::vector<Marker*> found;
+	for (uint32_t density : conf.densities) {
+		Grid<Marker> grid(world_width, world_height, density_side);
+		fillSquares(density_side, density, rng, [&](const sf::Vector2f& position) {
+			grid.add(Marker(position, Marker::ToHome, 10.0f));
+		});
+
+		for (uint32_t ants : conf.ants_counts) {
+			const Ants queries = makeAnts(ants, rng);
+			results.push_back(measure(conf, "grid_get_all_at", ants, density, [] {}, [&] {
+				uint64_t count = 0;
+				for (uint64_t i(0); i < queries.size(); ++i) {
+					grid.getAllAt(queries.getPosition(i), found);
+					count += found.size();
+				}
+				sink = sink + count;
+				return queries.size();
+			}));
+		}
+	}
+}
+
+
+// Adds ants markers to cells a few markers short of MAX_MARKERS_PER_CELL, most end up rejected.
+// The cells of the grid are density squares
+void benchAddNearFull(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	const uint32_t density = Conf::MAX_MARKERS_PER_CELL - 8;
+	const sf::Vector2f world_size(to<float>(world_width), to<float>(world_height));
+	for (uint32_t ants : conf.ants_counts) {
+		std::unique_ptr<Grid<Marker>> grid;
+		results.push_back(measure(conf, "grid_add_near_full", ants, density, [&] {
+			grid.reset(new Grid<Marker>(world_width, world_height, density_side));
+			fillSquares(density_side, density, rng, [&](const sf::Vector2f& position) {
+				grid->add(Marker(position, Marker::ToHome, 10.0f));
+			});
+		}, [&] {
+			uint64_t added = 0;
+			for (uint32_t i(0); i < ants; ++i) {
+				added += grid->add(Marker(getRandomPosition(rng, i, 2, sf::Vector2f(0.0f, 0.0f), world_size), Marker::ToHome, 10.0f)) != nullptr;
+			}
+			sink = sink + added;
+			return ants;
+		}));
+	}
+}
+
+
+// With field, the markers are deposited into a pheromone field of default texels instead
+void runFindMarker(const MicroConf& conf, std::vector<Result>& results, bool field)
+{
+	const CounterRNG rng(conf.seed);
+	for (uint32_t density : conf.densities) {
+		World world(world_width, world_height);
+		if (field) {
+			world.useField(World::default_field_texel_size);
+		}
+		fillWorld(world, density, rng);
+
+		for (uint32_t ants_count : conf.ants_counts) {
+			Ants ants = makeAnts(ants_count, rng);
+			results.push_back(measure(conf, field ? "find_marker_field" : "find_marker", ants_count, density, [] {}, [&] {
+				for (uint64_t i(0); i < ants.size(); ++i) {
+					ants.findMarker(i, world);
+				}
+				sink = sink + to<uint64_t>(ants.direction.getVec(0).x * 1000.0f);
+				return ants.size();
+			}));
+		}
+	}
+}
+
+
+void benchFindMarker(const MicroConf& conf, std::vector<Result>& results)
+{
+	runFindMarker(conf, results, false);
+}
+
+
+void benchFindMarkerField(const MicroConf& conf, std::vector<Result>& results)
+{
+	runFindMarker(conf, results, true);
+}
+
+
+// All the ants are due for a direction update, over the same markers as find_marker
+void benchSteerSensors(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	WorldChanges changes;
+	for (uint32_t density : conf.densities) {
+		World world(world_width, world_height);
+		world.useMarkerRaster();
+		fillWorld(world, density, rng);
+
+		for (uint32_t ants_count : conf.ants_counts) {
+			Ants ants = makeAnts(ants_count, rng);
+			std::fill(ants.last_direction_update.begin(), ants.last_direction_update.end(), 1.0f);
+			results.push_back(measure(conf, "steer_sensors", ants_count, density, [] {}, [&] {
+				ants.steerWithSensors(0, ants.size(), world, changes);
+				sink = sink + to<uint64_t>(ants.direction.getVec(0).x * 1000.0f);
+				return ants.size();
+			}));
+		}
+	}
+}
+
+
+// Half of the ants stand on the food piles, density does not apply
+void benchCheckFood(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	World world(world_width, world_height);
+	const sf::Vector2f center(to<float>(world_width / 2), to<float>(world_height / 2));
+	std::vector<sf::Vector2f> piles;
+	for (uint32_t p(0); p < 8; ++p) {
+		const float angle = 2.0f * PI * to<float>(p) / 8.0f;
+		piles.push_back(center + 350.0f * sf::Vector2f(cos(angle), sin(angle)));
+		for (int32_t x(-3); x < 4; ++x) {
+			for (int32_t y(-3); y < 4; ++y) {
+				world.addFoodAt(piles.back().x + 4.0f * x, piles.back().y + 4.0f * y, 5.0f);
+			}
+		}
+	}
+
+	WorldChanges changes;
+	for (uint32_t ants_count : conf.ants_counts) {
+		Ants ants = makeAnts(ants_count, rng);
+		for (uint32_t i(0); i < ants_count; i += 2) {
+			const sf::Vector2f position = getRandomPosition(rng, i, 3, piles[i / 2 % piles.size()] - sf::Vector2f(14.0f, 14.0f), sf::Vector2f(28.0f, 28.0f));
+			ants.position_x[i] = position.x;
+			ants.position_y[i] = position.y;
+		}
+
+		results.push_back(measure(conf, "check_food", ants_count, 0, [&] {
+			std::fill(ants.phase.begin(), ants.phase.end(), to<uint8_t>(Marker::ToFood));
+			changes.clear();
+		}, [&] {
+			for (uint64_t i(0); i < ants.size(); ++i) {
+				ants.checkFood(i, world, changes);
+			}
+			sink = sink + changes.picked_food.size();
+			return ants.size();
+		}));
+	}
+}
+
+
+// Runs the expiries of a full world until the last marker is gone, per expired marker
+void benchRemoveExpired(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	for (uint32_t density : conf.densities) {
+		std::unique_ptr<World> world;
+		results.push_back(measure(conf, "remove_expired_markers", 0, density, [&] {
+			world.reset(new World(world_width, world_height));
+			fillWorld(*world, density, rng);
+		}, [&] {
+			const uint64_t markers = world->markers_count;
+			while (world->markers_count) {
+				++world->tick;
+				world->removeExpiredMarkers();
+			}
+			return markers;
+		}));
+	}
+}
+
+
+// Marker quads refreshed as markers fade then handed out for upload, over the whole life of
+// the markers, per marker and tick. This replaced generating the whole vertex array every frame
+void benchMarkerVertices(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	for (uint32_t density : conf.densities) {
+		std::unique_ptr<World> world;
+		results.push_back(measure(conf, "marker_vertices", 0, density, [&] {
+			world.reset(new World(world_width, world_height));
+			fillWorld(*world, density, rng);
+			world->marker_vertices.flush(world->marker_update);
+		}, [&] {
+			// Markers are not removed here, the ones done keep a collapsed quad
+			const uint32_t ticks = to<uint32_t>(10.0f / world->decay_per_tick) + 1;
+			for (uint32_t t(0); t < ticks; ++t) {
+				++world->tick;
+				world->marker_vertices.update(world->tick, world->decay_per_tick);
+				world->marker_vertices.flush(world->marker_update);
+				sink = sink + world->marker_update.vertices.size();
+			}
+			return world->markers_count * ticks;
+		}));
+	}
+}
+
+
+// Evaporation and diffusion of both channels of a pheromone field of default texels on the
+// calling thread, per texel and tick. The cost does not depend on the density
+void benchFieldUpdate(const MicroConf& conf, std::vector<Result>& results)
+{
+	const CounterRNG rng(conf.seed);
+	const float dt = 0.016f;
+	for (uint32_t density : conf.densities) {
+		std::unique_ptr<World> world;
+		results.push_back(measure(conf, "field_update", 0, density, [&] {
+			world.reset(new World(world_width, world_height));
+			world->useField(World::default_field_texel_size);
+			fillWorld(*world, density, rng);
+		}, [&] {
+			const uint32_t ticks = 60;
+			for (uint32_t t(0); t < ticks; ++t) {
+				world->field->update(dt);
+			}
+			sink = sink + to<uint64_t>(world->field->get(0, 0, 0));
+			return 2 * world->field->getTexelsCount() * ticks;
+		}));
+	}
+}
+
+
+void writeJson(std::ostream& out, const MicroConf& conf, const std::vector<Result>& results)
+{
+	out << "{" << std::endl;
+	out << "  \"suite\": \"antsim_micro\"," << std::endl;
+	out << "  \"seed\": " << conf.seed << "," << std::endl;
+	out << "  \"samples\": " << conf.samples << "," << std::endl;
+	out << "  \"results\": [" << std::endl;
+	for (uint64_t i(0); i < results.size(); ++i) {
+		const Result& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"ants\": " << r.ants << ", \"density\": " << r.density
+			<< ", \"iterations\": " << r.iterations << ", \"median_ns\": " << r.median_ns
+			<< ", \"min_ns\": " << r.min_ns << ", \"max_ns\": " << r.max_ns << "}"
+			<< (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	out << "  ]" << std::endl;
+	out << "}" << std::endl;
+}
+
+
+// Only reads files written by writeJson, where each result is on its own line
+bool readJson(const std::string& path, std::vector<Result>& results)
+{
+	std::ifstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	auto getNumber = [](const std::string& line, const std::string& key) {
+		const uint64_t at = line.find("\"" + key + "\": ");
+		return at == std::string::npos ? 0.0 : std::strtod(line.c_str() + at + key.size() + 4, nullptr);
+	};
+
+	std::string line;
+	while (std::getline(file, line)) {
+		const std::string name_key = "\"name\": \"";
+		const uint64_t name_at = line.find(name_key);
+		if (name_at == std::string::npos) {
+			continue;
+		}
+		Result r;
+		const uint64_t name_begin = name_at + name_key.size();
+		r.name = line.substr(name_begin, line.find('"', name_begin) - name_begin);
+		r.ants = to<uint32_t>(getNumber(line, "ants"));
+		r.density = to<uint32_t>(getNumber(line, "density"));
+		r.iterations = to<uint32_t>(getNumber(line, "iterations"));
+		r.median_ns = getNumber(line, "median_ns");
+		r.min_ns = getNumber(line, "min_ns");
+		r.max_ns = getNumber(line, "max_ns");
+		results.push_back(r);
+	}
+	return true;
+}
+
+
+// Medians of the results both files share, ratios above 1 mean the candidate is slower
+int compare(const MicroConf& conf)
+{
+	std::vector<Result> baseline, candidate;
+	if (!readJson(conf.baseline_path, baseline) || !readJson(conf.candidate_path, candidate)) {
+		std::cout << "Cannot read '" << conf.baseline_path << "' or '" << conf.candidate_path << "'" << std::endl;
+		return 1;
+	}
+
+	uint32_t slower = 0;
+	for (const Result& c : candidate) {
+		const auto b = std::find_if(baseline.begin(), baseline.end(), [&](const Result& r) {
+			return r.name == c.name && r.ants == c.ants && r.density == c.density;
+		});
+		if (b == baseline.end() || b->median_ns <= 0.0) {
+			continue;
+		}
+		const double ratio = c.median_ns / b->median_ns;
+		const char* verdict = ratio > 1.0 + conf.threshold ? "slower" : (ratio < 1.0 - conf.threshold ? "faster" : "");
+		slower += ratio > 1.0 + conf.threshold;
+		std::cout << c.name << " ants=" << c.ants << " density=" << c.density << "  " << b->median_ns << " -> "
+			<< c.median_ns << " ns  x" << ratio << "  " << verdict << std::endl;
+	}
+	return slower ? 2 : 0;
+}
+
+
+void printUsage()
+{
+	std::cout << "Usage: antsim_micro [--ants N,N,...] [--densities N,N,...] [--samples N] [--seed N]" << std::endl;
+	std::cout << "                    [--filter NAME] [--out FILE]" << std::endl;
+	std::cout << "       antsim_micro --compare BASELINE CANDIDATE [--threshold RATIO]" << std::endl;
+}
+
+
+bool parseArgs(int argc, char** argv, MicroConf& conf)
+{
+	for (int i(1); i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			printUsage();
+			return false;
+		}
+
+		const char* value = argv[++i];
+		if (arg == "--ants") {
+			conf.ants_counts = parseList(value);
+		}
+		else if (arg == "--densities") {
+			conf.densities = parseList(value);
+		}
+		else if (arg == "--samples") {
+			conf.samples = to<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (arg == "--seed") {
+			conf.seed = std::strtoull(value, nullptr, 10);
+		}
+		else if (arg == "--filter") {
+			conf.filter = value;
+		}
+		else if (arg == "--out") {
+			conf.output_path = value;
+		}
+		else if (arg == "--threshold") {
+			conf.threshold = std::strtod(value, nullptr);
+		}
+		else if (arg == "--compare" && i + 1 < argc) {
+			conf.baseline_path = value;
+			conf.candidate_path = argv[++i];
+		}
+		else {
+			printUsage();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+	MicroConf conf;
+	if (!parseArgs(argc, argv, conf)) {
+		return 1;
+	}
+
+	if (!conf.baseline_path.empty()) {
+		return compare(conf);
+	}
+
+	using Bench = void (*)(const MicroConf&, std::vector<Result>&);
+	const std::vector<std::pair<std::string, Bench>> benches = {
+		{"grid_get_all_at", benchGetAllAt},
+		{"grid_add_near_full", benchAddNearFull},
+		{"find_marker", benchFindMarker},
+		{"find_marker_field", benchFindMarkerField},
+		{"steer_sensors", benchSteerSensors},
+		{"check_food", benchCheckFood},
+		{"remove_expired_markers", benchRemoveExpired},
+		{"marker_vertices", benchMarkerVertices},
+		{"field_update", benchFieldUpdate}
+	};
+
+	std::vector<Result> results;
+	for (const auto& bench : benches) {
+		if (isSelected(conf, bench.first)) {
+			bench.second(conf, results);
+		}
+	}
+
+	if (conf.output_path.empty()) {
+		writeJson(std::cout, conf, results);
+		return 0;
+	}
+
+	std::ofstream out(conf.output_path, std::ios::trunc);
+	if (!out) {
+		std::cout << "Cannot write '" << conf.output_path << "'" << std::endl;
+		return 1;
+	}
+	writeJson(out, conf, results);
+	return 0;
+}
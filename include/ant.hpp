@@ -1,167 +1,366 @@
 #pragma once
 
-#include <list>
 #include "marker.hpp"
 #include "food.hpp"
 #include "world.hpp"
 #include "config.hpp"
 #include <iostream>
 #include "direction.hpp"
+#include "counter_rng.hpp"
+#include "simd.hpp"
+#include "digest.hpp"
 
 
-struct Ant
+// Behaviour constants, shared by all the ants of a colony
+struct AntParameters
 {
-	Ant() = default;
-
-	Ant(float x, float y, float angle, uint32_t id_)
-		: position(x, y)
-		, direction(angle)
-		, last_direction_update(getRandUnder(100.0f) * 0.01f * direction_update_period)
-		, last_marker(getRandUnder(100.0f) * 0.01f * marker_period)
-		, phase(Marker::Type::ToFood)
-		, reserve(0.0f)
-		, id(id_)
+	// Centroid steers toward the intensity weighted center of the markers in front of the ant,
+	// Sensors toward the strongest of three points of the marker raster, see World::useMarkerRaster
+	enum Steering : uint32_t {
+		Centroid,
+		Sensors
+	};
+
+	float width = 2.0f;
+	float length = 3.5f;
+	float move_speed = 50.0f;
+	float marker_detection_max_dist = 40.0f;
+	float direction_update_period = 0.125f;
+	float marker_period = 0.25f;
+	float max_reserve = 2000.0f;
+	float direction_noise_range = PI * 0.1f;
+	float marker_reserve_consumption = 0.02f;
+	float colony_size = 20.0f;
+	float rotation_speed = 10.0f;
+	Directions::Mode direction_mode = Directions::Angle;
+	Steering steering = Centroid;
+	// The sensors are sensor_distance ahead of the ant, straight and sensor_angle to each side
+	float sensor_angle = PI * 0.25f;
+	float sensor_distance = 20.0f;
+};
+
+
+// The ants of a colony stored as structure of arrays: the state of ant i is at index i
+// of every array. Movement, timers and direction easing run as batch kernels over ranges
+// of ants while the decisions needing the world run per ant
+struct Ants
+{
+	Ants() = default;
+
+	explicit Ants(const AntParameters& parameters_, uint16_t colony_ = 0)
+		: parameters(parameters_)
+		, colony(colony_)
+		, direction(parameters_.rotation_speed, parameters_.direction_mode)
+	{}
+
+	void add(float x, float y, uint32_t id_, const CounterRNG& rng)
 	{
-		reserve = max_reserve;
+		position_x.push_back(x);
+		position_y.push_back(y);
+		direction.add(rng.getRange(PI, id_, 0, CounterRNG::InitAngle));
+		last_direction_update.push_back(rng.getUnder(parameters.direction_update_period, id_, 0, CounterRNG::InitDirectionTimer));
+		last_marker.push_back(rng.getUnder(parameters.marker_period, id_, 0, CounterRNG::InitMarkerTimer));
+		phase.push_back(Marker::ToFood);
+		reserve.push_back(parameters.max_reserve);
+		id.push_back(id_);
 	}
 
-	void update(const float dt, World& world)
+	void reserveCapacity(uint64_t count)
 	{
-		updatePosition(dt);
-		if (phase == Marker::ToFood) {
-			checkFood(world);
+		for (std::vector<float>* v : {&position_x, &position_y, &last_direction_update, &last_marker, &reserve}) {
+			v->reserve(count);
 		}
+		direction.reserve(count);
+		phase.reserve(count);
+		id.reserve(count);
+	}
+
+	uint64_t size() const
+	{
+		return id.size();
+	}
+
+	sf::Vector2f getPosition(uint64_t i) const
+	{
+		return sf::Vector2f(position_x[i], position_y[i]);
+	}
 
-		last_direction_update += dt;
-		if (last_direction_update > direction_update_period) {
-			findMarker(world);
-			direction += getRandRange(direction_noise_range);
-			last_direction_update = 0.0f;
+	// Updates the ants of [begin, end). The world is only read here, all modifications are recorded in changes
+	void update(uint64_t begin, uint64_t end, const float dt, World& world, WorldChanges& changes, const CounterRNG& rng, uint32_t tick)
+	{
+		updatePositions(begin, end, dt, world.size);
+
+		for (uint64_t i(begin); i < end; ++i) {
+			if (phase[i] == Marker::ToFood) {
+				checkFood(i, world, changes);
+			}
 		}
 
-		last_marker += dt;
-		if (last_marker >= marker_period) {
-			addMarker(world);
+		// Once checkFood turned the ants that found food around
+		if (parameters.steering == AntParameters::Sensors) {
+			steerWithSensors(begin, end, world, changes);
+		}
+		else {
+			for (uint64_t i(begin); i < end; ++i) {
+				if (last_direction_update[i] > parameters.direction_update_period) {
+					changes.examined_markers += findMarker(i, world);
+					++changes.marker_queries;
+				}
+			}
 		}
 
-		direction.update(dt);
+		for (uint64_t i(begin); i < end; ++i) {
+			if (last_direction_update[i] > parameters.direction_update_period) {
+				direction.addTarget(i, rng.getRange(parameters.direction_noise_range, id[i], tick, CounterRNG::DirectionNoise));
+				last_direction_update[i] = 0.0f;
+			}
+
+			if (last_marker[i] >= parameters.marker_period) {
+				addMarker(i, changes);
+			}
+		}
+
+		direction.update(begin, end, dt);
 	}
 
-	void updatePosition(const float dt)
+	// Moves the ants along their direction, wraps them around the world and advances their timers
+	void updatePositions(uint64_t begin, uint64_t end, const float dt, const sf::Vector2f& world_size)
 	{
-		position += (dt * move_speed) * direction.getVec();
+		const float step = dt * parameters.move_speed;
+		simd::forEachPack(begin, end, [&](auto pack, uint64_t i) {
+			using V = decltype(pack);
+			const auto zero = V::set(0.0f);
+			const auto width = V::set(world_size.x);
+			const auto height = V::set(world_size.y);
+
+			auto x = V::add(V::load(&position_x[i]), V::mul(V::set(step), V::load(&direction.vec_x[i])));
+			auto y = V::add(V::load(&position_y[i]), V::mul(V::set(step), V::load(&direction.vec_y[i])));
+
+			x = V::select(V::lt(x, zero), width, x);
+			y = V::select(V::lt(y, zero), height, y);
+			x = V::select(V::gt(x, width), zero, x);
+			y = V::select(V::gt(y, height), zero, y);
 
-		position.x = position.x < 0.0f ? Conf::WIN_WIDTH : position.x;
-		position.y = position.y < 0.0f ? Conf::WIN_HEIGHT : position.y;
+			V::store(&position_x[i], x);
+			V::store(&position_y[i], y);
 
-		position.x = position.x > Conf::WIN_WIDTH ? 0.0f : position.x;
-		position.y = position.y > Conf::WIN_HEIGHT ? 0.0f : position.y;
+			V::store(&last_direction_update[i], V::add(V::load(&last_direction_update[i]), V::set(dt)));
+			V::store(&last_marker[i], V::add(V::load(&last_marker[i]), V::set(dt)));
+		});
 	}
 
-	void checkFood(World& world)
+	void checkFood(uint64_t i, World& world, WorldChanges& changes)
 	{
-		const std::list<Food*> food_spots = world.grid_food.getAllAt(position);
-		for (Food* fp : food_spots) {
-			if (getLength(position - fp->position) < fp->radius) {
-				phase = Marker::ToHome;
-				direction.addNow(PI);
-				reserve = max_reserve;
-				fp->pick();
-				return;
-			}
+		const sf::Vector2f position = getPosition(i);
+		// Most ants are far from any food
+		if (!world.food_occupancy.isNear(world.grid_food.getCellCoords(position))) {
+			return;
+		}
+		Food* food = world.grid_food.findAround(position, [&](const Food& f) {
+			return getLength(position - f.position) < f.radius;
+		});
+
+		if (food) {
+			phase[i] = Marker::ToHome;
+			direction.addNow(i, PI);
+			reserve[i] = parameters.max_reserve;
+			changes.picked_food.push_back(food);
+			changes.picked_food_ants.push_back(id[i]);
 		}
 	}
 
-	void checkColony(const sf::Vector2f colony_position)
+	void checkColony(uint64_t begin, uint64_t end, const sf::Vector2f colony_position)
 	{
-		if (getLength(position - colony_position) < colony_size) {
-			if (phase == Marker::ToHome) {
-				phase = Marker::ToFood;
-				direction.addNow(PI);
+		for (uint64_t i(begin); i < end; ++i) {
+			if (getLength(getPosition(i) - colony_position) < parameters.colony_size) {
+				if (phase[i] == Marker::ToHome) {
+					phase[i] = Marker::ToFood;
+					direction.addNow(i, PI);
+				}
+				reserve[i] = parameters.max_reserve;
 			}
-			reserve = max_reserve;
 		}
 	}
 
-	void findMarker(World& world)
+	// Steers toward the markers of the half disc in front of the ant, returns the number of
+	// markers examined. With the pheromone field its texels count as markers at their center
+	uint32_t findMarker(uint64_t i, World& world)
 	{
-		std::list<Marker*> markers = world.getGrid(phase).getAllAt(position);
-
+		const sf::Vector2f position = getPosition(i);
 		float total_intensity = 0.0f;
 		sf::Vector2f point(0.0f, 0.0f);
+		uint32_t examined = 0;
+
+		const sf::Vector2f dir_vec = direction.getVec(i);
+		const Marker::Type type = static_cast<Marker::Type>(phase[i]);
 
-		const sf::Vector2f dir_vec = direction.getVec();
+		if (world.field) {
+			examined += world.field->forEachInHalfDisc(World::getChannel(colony, type), position, dir_vec, parameters.marker_detection_max_dist,
+				[&](const sf::Vector2f& center, float value) {
+					total_intensity += value;
+					point += value * center;
+				});
+		}
 
-		for (Marker* mp : markers) {
-			const Marker& m = *mp;
+		// Only permanent markers with the pheromone field
+		Grid<Marker>& grid = world.getGrid(colony, type);
+		grid.forEachInHalfDisc(position, dir_vec, parameters.marker_detection_max_dist, [&](const Marker& m) {
+			++examined;
 			const sf::Vector2f to_marker = m.position - position;
 			const float length = getLength(to_marker);
 
-			if (length < marker_detection_max_dist) {
+			if (length < parameters.marker_detection_max_dist) {
 				if (dot(to_marker, dir_vec) > 0.0f) {
-					total_intensity += m.intensity;
-					point += m.intensity * m.position;
+					const float intensity = world.getIntensity(m);
+					if (intensity >= 0.0f) {
+						total_intensity += intensity;
+						point += intensity * m.position;
+					}
 				}
 			}
-		}
+		});
 
 		if (total_intensity) {
-			direction = getAngle(point / total_intensity - position);
+			direction.setTargetVec(i, point / total_intensity - position);
 		}
+		return examined;
 	}
 
-	void addMarker(World& world)
+	// Steers the ants of [begin, end) due for a direction update toward the strongest of their
+	// left, center and right sensors, keeping their heading when the center one is at least as
+	// strong as both sides. Sensor positions and decisions are computed by packs over blocks of
+	// ants, only the reads of the marker raster are done per ant
+	void steerWithSensors(uint64_t begin, uint64_t end, World& world, WorldChanges& changes)
 	{
-		if (reserve > 1.0f) {
-			world.addMarker(Marker(position, phase == Marker::ToFood ? Marker::ToHome : Marker::ToFood, reserve * marker_reserve_consumption));
-			reserve *= 1.0f - marker_reserve_consumption;
+		constexpr uint64_t block_size = 64;
+		// Left, center and right
+		float sensor_x[3][block_size], sensor_y[3][block_size], values[3][block_size];
+		float target_x[block_size], target_y[block_size], found[block_size];
+		const float cos_angle = std::cos(parameters.sensor_angle);
+		const float sin_angle = std::sin(parameters.sensor_angle);
+		const float distance = parameters.sensor_distance;
+
+		for (uint64_t block(begin); block < end; block += block_size) {
+			const uint64_t count = std::min(block_size, end - block);
+
+			simd::forEachPack(0, count, [&](auto pack, uint64_t j) {
+				using V = decltype(pack);
+				const auto x = V::load(&position_x[block + j]);
+				const auto y = V::load(&position_y[block + j]);
+				const auto vx = V::load(&direction.vec_x[block + j]);
+				const auto vy = V::load(&direction.vec_y[block + j]);
+				const auto c = V::set(cos_angle);
+				const auto s = V::set(sin_angle);
+				const auto d = V::set(distance);
+				// Heading rotated by -angle, 0 and +angle
+				const auto left_x = V::add(V::mul(vx, c), V::mul(vy, s));
+				const auto left_y = V::sub(V::mul(vy, c), V::mul(vx, s));
+				const auto right_x = V::sub(V::mul(vx, c), V::mul(vy, s));
+				const auto right_y = V::add(V::mul(vy, c), V::mul(vx, s));
+				V::store(&sensor_x[0][j], V::add(x, V::mul(d, left_x)));
+				V::store(&sensor_y[0][j], V::add(y, V::mul(d, left_y)));
+				V::store(&sensor_x[1][j], V::add(x, V::mul(d, vx)));
+				V::store(&sensor_y[1][j], V::add(y, V::mul(d, vy)));
+				V::store(&sensor_x[2][j], V::add(x, V::mul(d, right_x)));
+				V::store(&sensor_y[2][j], V::add(y, V::mul(d, right_y)));
+			});
+
+			for (uint64_t j(0); j < count; ++j) {
+				const uint64_t i = block + j;
+				const bool due = last_direction_update[i] > parameters.direction_update_period;
+				const uint32_t channel = World::getChannel(colony, static_cast<Marker::Type>(phase[i]));
+				for (uint32_t k(0); k < 3; ++k) {
+					values[k][j] = due ? world.sampleMarkers(channel, sf::Vector2f(sensor_x[k][j], sensor_y[k][j])) : 0.0f;
+				}
+				changes.marker_queries += due;
+				changes.examined_markers += due ? 3 : 0;
+			}
+
+			simd::forEachPack(0, count, [&](auto pack, uint64_t j) {
+				using V = decltype(pack);
+				const auto left = V::load(&values[0][j]);
+				const auto center = V::load(&values[1][j]);
+				const auto right = V::load(&values[2][j]);
+				const auto x = V::load(&position_x[block + j]);
+				const auto y = V::load(&position_y[block + j]);
+				const auto to_left = V::both(V::gt(left, center), V::gt(left, right));
+				const auto to_right = V::both(V::gt(right, center), V::gt(right, left));
+				V::store(&target_x[j], V::sub(V::select(to_left, V::load(&sensor_x[0][j]), V::select(to_right, V::load(&sensor_x[2][j]), V::load(&sensor_x[1][j]))), x));
+				V::store(&target_y[j], V::sub(V::select(to_left, V::load(&sensor_y[0][j]), V::select(to_right, V::load(&sensor_y[2][j]), V::load(&sensor_y[1][j]))), y));
+				const auto strongest = V::max(V::max(left, center), right);
+				V::store(&found[j], V::select(V::gt(strongest, V::set(0.0f)), V::set(1.0f), V::set(0.0f)));
+			});
+
+			for (uint64_t j(0); j < count; ++j) {
+				if (found[j] > 0.0f) {
+					direction.setTargetVec(block + j, sf::Vector2f(target_x[j], target_y[j]));
+				}
+			}
+		}
+	}
+
+	void addMarker(uint64_t i, WorldChanges& changes)
+	{
+		if (reserve[i] > 1.0f) {
+			const Marker::Type type = phase[i] == Marker::ToFood ? Marker::ToHome : Marker::ToFood;
+			changes.markers.push_back(Marker(getPosition(i), type, reserve[i] * parameters.marker_reserve_consumption, false, colony));
+			changes.marker_ants.push_back(id[i]);
+			reserve[i] *= 1.0f - parameters.marker_reserve_consumption;
 		}
 
-		last_marker = 0.0f;
+		last_marker[i] = 0.0f;
 	}
 
-	void render_food(sf::RenderTarget& target, const sf::RenderStates& states) const
+	// Sum of the hashes of every ant over its whole state, see digest.hpp
+	uint64_t getDigest() const
 	{
-		if (phase == Marker::ToHome) {
+		uint64_t result = 0;
+		for (uint64_t i(0); i < size(); ++i) {
+			uint64_t h = digest::combine(id[i], phase[i]);
+			for (const std::vector<float>* v : {&position_x, &position_y, &last_direction_update, &last_marker, &reserve,
+				&direction.angle, &direction.target_angle, &direction.vec_x, &direction.vec_y, &direction.target_x, &direction.target_y}) {
+				h = digest::combine(h, digest::getBits((*v)[i]));
+			}
+			result += h;
+		}
+		return result;
+	}
+
+	// Writes the carried food quad and returns the number of vertices written
+	uint32_t render_food_in(uint64_t i, sf::Vertex* quad) const
+	{
+		if (phase[i] == Marker::ToHome) {
 			const float radius = 2.0f;
-			sf::CircleShape circle(radius);
-			circle.setOrigin(radius, radius);
-			circle.setPosition(position + length * 0.5f * direction.getVec());
-			circle.setFillColor(Conf::FOOD_COLOR);
-			target.draw(circle, states);
+			setCircleQuad(quad, getPosition(i) + parameters.length * 0.5f * direction.getVec(i), radius, Conf::FOOD_COLOR);
+			return 4;
 		}
+		return 0;
 	}
 
-	void render_in(sf::VertexArray& va, const uint32_t index) const
+	// Only writes the positions, see Colony::writeVertices for the other attributes
+	void render_in(uint64_t i, sf::Vertex* quad) const
 	{
-		const sf::Vector2f dir_vec(direction.getVec());
+		const sf::Vector2f position = getPosition(i);
+		const sf::Vector2f dir_vec(direction.getVec(i));
 		const sf::Vector2f nrm_vec(-dir_vec.y, dir_vec.x);
+		const float width = parameters.width;
+		const float length = parameters.length;
 
-		va[index + 0].position = position - width * nrm_vec + length * dir_vec;
-		va[index + 1].position = position + width * nrm_vec + length * dir_vec;
-		va[index + 2].position = position + width * nrm_vec - length * dir_vec;
-		va[index + 3].position = position - width * nrm_vec - length * dir_vec;
+		quad[0].position = position - width * nrm_vec + length * dir_vec;
+		quad[1].position = position + width * nrm_vec + length * dir_vec;
+		quad[2].position = position + width * nrm_vec - length * dir_vec;
+		quad[3].position = position - width * nrm_vec - length * dir_vec;
 	}
 
-	sf::Vector2f position;
-	
-	Direction direction;
-
-	float last_direction_update;
-	float last_marker;
-	Marker::Type phase;
-	float reserve;
-	const uint32_t id;
-
-	// Parameters
-	const float width = 2.0f;
-	const float length = 3.5f;
-	const float move_speed = 50.0f;
-	const float marker_detection_max_dist = 40.0f;
-	const float direction_update_period = 0.125f;
-	const float marker_period = 0.25f;
-	const float max_reserve = 2000.0f;
-	const float direction_noise_range = PI * 0.1f;
-	const float marker_reserve_consumption = 0.02f;
-	const float colony_size = 20.0f;
+	AntParameters parameters;
+	// Index of the colony, selects the marker channels the ants follow and lay
+	uint16_t colony;
+
+	std::vector<float> position_x, position_y;
+	Directions direction;
+	std::vector<float> last_direction_update;
+	std::vector<float> last_marker;
+	std::vector<float> reserve;
+	std::vector<uint8_t> phase;
+	std::vector<uint32_t> id;
 };
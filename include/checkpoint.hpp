@@ -0,0 +1,144 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "world.hpp"
+#include "colony.hpp"
+
+
+// Binary checkpoint of a World and its colonies, little-endian. The file is a fixed header and
+// one ColonyHeader per colony followed by sections whose sizes all follow from the headers:
+//  - for each colony, its ants, one column per array of Ants, the last one, phases, padded to
+//    8 bytes, then its home markers and its food markers
+//  - food
+// Marker and food sections are the index and object count of every cell holding objects, by
+// increasing index, then the objects cell by cell, padded to 8 bytes.
+// Food is linked to its permanent markers by position so no link has to be stored.
+// The CounterRNG has no state besides the seed, the ticks give the position in its streams
+namespace checkpoint
+{
+
+constexpr char magic[8] = {'A', 'N', 'T', 'S', 'I', 'M', 'C', 'K'};
+constexpr uint32_t version = 5;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+
+	float world_width;
+	float world_height;
+	uint32_t marker_cell_size;
+	uint32_t food_cell_size;
+	uint32_t world_tick;
+	float decay_per_tick;
+	uint32_t colonies_count;
+	uint32_t food_cells_count;
+	uint64_t food_count;
+};
+
+struct ColonyHeader
+{
+	uint64_t seed;
+	float colony_x;
+	float colony_y;
+	uint32_t colony_tick;
+	uint32_t ants_count;
+	uint32_t id;
+
+	// AntParameters
+	uint32_t direction_mode;
+	float ant_width;
+	float ant_length;
+	float move_speed;
+	float marker_detection_max_dist;
+	float direction_update_period;
+	float marker_period;
+	float max_reserve;
+	float direction_noise_range;
+	float marker_reserve_consumption;
+	float colony_size;
+	float rotation_speed;
+	uint32_t steering;
+	float sensor_angle;
+	float sensor_distance;
+
+	uint32_t home_marker_cells_count;
+	uint32_t food_marker_cells_count;
+	uint64_t home_markers_count;
+	uint64_t food_markers_count;
+};
+
+struct CellRecord
+{
+	uint64_t index;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+// Markers and food are stored as they are laid out in memory, with their padding zeroed and no
+// vertex slot, so that restore copies the objects of a cell at once from the file. Marker records
+// are kept as bytes so that copies keep the padding zeroed
+struct MarkerRecord
+{
+	uint8_t bytes[sizeof(Marker)];
+};
+typedef Food FoodRecord;
+
+// Conversions between objects and their records, shared with the worker processes which exchange
+// cells in the same records. Markers get the colony of the grid they are read into, colony is
+// ignored for food so that templates convert both the same way
+MarkerRecord toRecord(const Marker& m);
+FoodRecord toRecord(const Food& f);
+Marker fromRecord(const MarkerRecord& record, uint16_t colony);
+Food fromRecord(const FoodRecord& record, uint16_t colony = 0);
+
+// Writes the checkpoint sequentially in a single pass, returns false on error or when the world
+// uses the pheromone field
+bool save(const std::string& path, const World& world, const std::vector<Colony>& colonies);
+
+
+// Read only view of a checkpoint file: memory mapped where available, read at once otherwise
+class Reader
+{
+public:
+	Reader();
+	~Reader();
+
+	Reader(const Reader&) = delete;
+	Reader& operator=(const Reader&) = delete;
+
+	// Returns false if the file cannot be read, is not a checkpoint of this version, describes a
+	// world World cannot build or if its sections do not match the counts of its headers
+	bool open(const std::string& path);
+
+	const Header& getHeader() const
+	{
+		return *reinterpret_cast<const Header*>(m_data);
+	}
+
+	const ColonyHeader& getColonyHeader(uint32_t colony) const
+	{
+		return reinterpret_cast<const ColonyHeader*>(m_data + sizeof(Header))[colony];
+	}
+
+	AntParameters getAntParameters(uint32_t colony) const;
+
+	// world has to have the size and colonies count of the checkpointed one and colonies to
+	// be built with the checkpoint positions, seeds and ant parameters, see makeColonies.
+	// The world gets the marker raster when a colony steers with sensors
+	bool restore(World& world, std::vector<Colony>& colonies) const;
+
+	// Colonies with the positions, seeds and ant parameters of the checkpoint, ready for restore
+	std::vector<Colony> makeColonies() const;
+
+private:
+	const uint8_t* m_data;
+	uint64_t m_size;
+	// Only used when the file could not be mapped
+	std::vector<uint8_t> m_buffer;
+	void* m_mapping;
+};
+
+}
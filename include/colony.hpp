@@ -1,76 +1,272 @@
 #pragma once
 #include <SFML/Graphics.hpp>
 #include <vector>
-#include <list>
+#include <algorithm>
 #include "ant.hpp"
 #include "utils.hpp"
 #include "world.hpp"
+#include "thread_pool.hpp"
+#include "profiler.hpp"
 
 
 struct Colony
 {
-	Colony(float x, float y, uint32_t n)
-		: position(x, y)
+	// id selects the marker channels of the colony, see World::getChannel
+	Colony(float x, float y, uint32_t n, uint64_t seed = 0, const AntParameters& ant_parameters = AntParameters(), uint16_t id_ = 0)
+		: id(id_)
+		, position(x, y)
+		, rng(seed)
+		, tick(0)
+		, ants(ant_parameters, id_)
 		, last_direction_update(0.0f)
-		, ants_va(sf::Quads, 4 * n)
 	{
-		for (uint32_t i(n); i--;) {
-			ants.emplace_back(x, y, getRandRange(2.0f * PI), n - i - 1);
+		ants.reserveCapacity(n);
+		for (uint32_t i(0); i < n; ++i) {
+			ants.add(x, y, i, rng);
 		}
 
-		for (uint64_t i(0); i < n; ++i) {
-			const uint64_t index = 4 * i;
-			ants_va[index + 0].color = Conf::ANT_COLOR;
-			ants_va[index + 1].color = Conf::ANT_COLOR;
-			ants_va[index + 2].color = Conf::ANT_COLOR;
-			ants_va[index + 3].color = Conf::ANT_COLOR;
-
-			ants_va[index + 0].texCoords = sf::Vector2f(0.0f, 0.0f);
-			ants_va[index + 1].texCoords = sf::Vector2f(73.0f, 0.0f);
-			ants_va[index + 2].texCoords = sf::Vector2f(73.0f, 107.0f);
-			ants_va[index + 3].texCoords = sf::Vector2f(0.0f, 107.0f);
+		resizeChunks();
+	}
+
+	// Ants are split in fixed size chunks that do not depend on the number of threads,
+	// each chunk records its own world changes which are then applied in chunk order
+	void update(const float dt, World& world, ThreadPool& thread_pool)
+	{
+		reserveStencils(world);
+		thread_pool.parallelFor(to<uint32_t>(chunks.size()), [&](uint32_t chunk_index) {
+			updateChunk(chunk_index, dt, world);
+		});
+
+		for (UpdateChunk& chunk : chunks) {
+			world.apply(chunk.changes);
+		}
+
+		++tick;
+	}
+
+	// Updates all the colonies in one parallel pass over their chunks, so that small colonies
+	// still spread over the cores. Every colony sees the world as it was before the tick, the
+	// changes are applied in colony order then in chunk order
+	static void updateAll(std::vector<Colony>& colonies, const float dt, World& world, ThreadPool& thread_pool, PhaseTimes* times = nullptr)
+	{
+		updateChunks(colonies, dt, world, thread_pool, times);
+
+		ScopedTimer timer(times, PhaseTimes::ApplyChanges);
+		for (Colony& colony : colonies) {
+			for (UpdateChunk& chunk : colony.chunks) {
+				world.apply(chunk.changes);
+			}
+			++colony.tick;
 		}
 	}
 
-	void update(const float dt, World& world)
-	{		
-		for (Ant& ant : ants) {
-			ant.update(dt, world);
+	// Parallel part of updateAll, the changes are left in the chunks
+	static void updateChunks(std::vector<Colony>& colonies, const float dt, World& world, ThreadPool& thread_pool, PhaseTimes* times = nullptr)
+	{
+		std::vector<uint32_t> first_chunks(colonies.size() + 1, 0);
+		for (uint32_t i(0); i < colonies.size(); ++i) {
+			first_chunks[i + 1] = first_chunks[i] + to<uint32_t>(colonies[i].chunks.size());
+			colonies[i].reserveStencils(world);
 		}
 
-		for (Ant& ant : ants) {
-			ant.checkColony(position);
+		thread_pool.parallelFor(first_chunks.back(), [&](uint32_t chunk_index) {
+			const uint32_t colony_index = to<uint32_t>(std::upper_bound(first_chunks.begin(), first_chunks.end(), chunk_index) - first_chunks.begin()) - 1;
+			colonies[colony_index].updateChunk(chunk_index - first_chunks[colony_index], dt, world, times != nullptr);
+		});
+
+		if (times) {
+			for (Colony& colony : colonies) {
+				for (UpdateChunk& chunk : colony.chunks) {
+					times->add(chunk.times);
+					chunk.times.clear();
+				}
+			}
 		}
 	}
 
-	void render(sf::RenderTarget& target, const sf::RenderStates& states) const
+	// Marker grids are queried from the pool threads, their stencils have to be ready before
+	void reserveStencils(World& world) const
 	{
-		for (const Ant& a : ants) {
-			a.render_food(target, states);
+		for (Marker::Type type : {Marker::ToHome, Marker::ToFood}) {
+			world.getGrid(id, type).reserveStencilRadius(ants.parameters.marker_detection_max_dist);
 		}
+	}
 
-		uint32_t index = 0;
-		for (const Ant& a : ants) {
-			a.render_in(ants_va, 4 * (index++));
+	// Has to be called when ants are added or removed
+	void resizeChunks()
+	{
+		chunks.resize((ants.size() + chunk_size - 1) / chunk_size);
+	}
+
+	// With profile, the time spent is added to the times of the chunk
+	void updateChunk(uint32_t chunk_index, const float dt, World& world, bool profile = false)
+	{
+		UpdateChunk& chunk = chunks[chunk_index];
+		chunk.changes.clear();
+
+		const uint64_t begin = to<uint64_t>(chunk_index) * chunk_size;
+		const uint64_t end = std::min(begin + chunk_size, ants.size());
+		{
+			ScopedTimer timer(profile ? &chunk.times : nullptr, PhaseTimes::AntUpdate);
+			ants.update(begin, end, dt, world, chunk.changes, rng, tick);
 		}
+		ScopedTimer timer(profile ? &chunk.times : nullptr, PhaseTimes::CheckColony);
+		ants.checkColony(begin, end, position);
+	}
+
+	// Writes the quads of the ants and of the food they carry
+	void writeVertices(std::vector<sf::Vertex>& ants_vertices, std::vector<sf::Vertex>& food_vertices) const
+	{
+		food_vertices.clear();
+		writeVertices(ants_vertices, 0, food_vertices);
+	}
+
+	// Writes the ant quads from ants_offset and appends the carried food quads, so that
+	// several colonies can share the same arrays
+	void writeVertices(std::vector<sf::Vertex>& ants_vertices, uint64_t ants_offset, std::vector<sf::Vertex>& food_vertices) const
+	{
+		const uint64_t ants_count = ants.size();
+		uint64_t food_index = food_vertices.size();
+		food_vertices.resize(food_index + 4 * ants_count);
+		for (uint64_t i(0); i < ants_count; ++i) {
+			food_index += ants.render_food_in(i, &food_vertices[food_index]);
+		}
+		food_vertices.resize(food_index);
+
+		// Colors and texture coordinates do not change, they are only written when the array grows
+		const uint64_t initialized = std::max(ants_vertices.size(), ants_offset);
+		ants_vertices.resize(std::max(ants_vertices.size(), ants_offset + 4 * ants_count));
+		const sf::Color color = getColor(id);
+		for (uint64_t index(initialized); index < ants_offset + 4 * ants_count; index += 4) {
+			ants_vertices[index + 0].color = color;
+			ants_vertices[index + 1].color = color;
+			ants_vertices[index + 2].color = color;
+			ants_vertices[index + 3].color = color;
+
+			ants_vertices[index + 0].texCoords = sf::Vector2f(0.0f, 0.0f);
+			ants_vertices[index + 1].texCoords = sf::Vector2f(73.0f, 0.0f);
+			ants_vertices[index + 2].texCoords = sf::Vector2f(73.0f, 107.0f);
+			ants_vertices[index + 3].texCoords = sf::Vector2f(0.0f, 107.0f);
+		}
+
+		for (uint64_t i(0); i < ants_count; ++i) {
+			ants.render_in(i, &ants_vertices[ants_offset + 4 * i]);
+		}
+	}
+
+	// Writes the vertices of all the colonies one after the other
+	static void writeVertices(const std::vector<Colony>& colonies, std::vector<sf::Vertex>& ants_vertices, std::vector<sf::Vertex>& food_vertices)
+	{
+		food_vertices.clear();
+		uint64_t ants_offset = 0;
+		for (const Colony& colony : colonies) {
+			colony.writeVertices(ants_vertices, ants_offset, food_vertices);
+			ants_offset += 4 * colony.ants.size();
+		}
+	}
+
+	// The first colony keeps the original ant color, the next ones cycle through a palette
+	static sf::Color getColor(uint32_t colony_id)
+	{
+		static const sf::Color palette[] = {
+			Conf::ANT_COLOR,
+			sf::Color(255, 196, 54),
+			sf::Color(80, 170, 255),
+			sf::Color(230, 90, 230),
+			sf::Color(90, 230, 200),
+			sf::Color(255, 140, 40),
+			sf::Color(240, 240, 240),
+			sf::Color(150, 230, 80),
+		};
+		return palette[colony_id % (sizeof(palette) / sizeof(palette[0]))];
+	}
+
+	void render(sf::RenderTarget& target, const sf::RenderStates& states) const
+	{
+		writeVertices(ants_vertices, food_vertices);
+		render(target, states, ants_vertices, food_vertices, {position}, size);
+	}
+
+	static void render(sf::RenderTarget& target, const sf::RenderStates& states, const std::vector<sf::Vertex>& ants_vertices,
+		const std::vector<sf::Vertex>& food_vertices, const std::vector<sf::Vector2f>& positions, float size)
+	{
+		sf::RenderStates rs_food = states;
+		rs_food.texture = &(*Conf::CIRCLE_TEXTURE);
+		target.draw(food_vertices.data(), food_vertices.size(), sf::Quads, rs_food);
 
 		sf::RenderStates rs = states;
 		rs.texture = &(*Conf::ANT_TEXTURE);
-		target.draw(ants_va, rs);
+		target.draw(ants_vertices.data(), ants_vertices.size(), sf::Quads, rs);
 
 		sf::CircleShape circle(size);
 		circle.setOrigin(size, size);
-		circle.setPosition(position);
 		circle.setFillColor(Conf::COLONY_COLOR);
-		target.draw(circle, states);
+		for (const sf::Vector2f& position : positions) {
+			circle.setPosition(position);
+			target.draw(circle, states);
+		}
 	}
 
+	uint64_t getDigest() const
+	{
+		return digest::combine(digest::combine(id, tick), ants.getDigest());
+	}
+
+	struct UpdateChunk
+	{
+		WorldChanges changes;
+		PhaseTimes times;
+	};
+
+	static constexpr uint32_t chunk_size = 256;
+
+	const uint16_t id;
 	const sf::Vector2f position;
-	std::vector<Ant> ants;
-	mutable sf::VertexArray ants_va;
+	// Random numbers only depend on the seed, the ant id and the tick
+	const CounterRNG rng;
+	uint32_t tick;
+	Ants ants;
+	std::vector<UpdateChunk> chunks;
+	mutable std::vector<sf::Vertex> ants_vertices;
+	// Food carried by the ants going home
+	mutable std::vector<sf::Vertex> food_vertices;
 	const float size = 20.0f;
 
 	float last_direction_update;
 	const float direction_update_period = 0.25f;
 
 };
+
+
+
+// One colony per entry of ants_counts with that many ants, the first one at center and the next
+// ones evenly spread on a ring around it. Colony i is seeded with seed + i so that every colony
+// draws its own numbers
+inline std::vector<Colony> makeColonies(const std::vector<uint32_t>& ants_counts, const sf::Vector2f& center, float ring_radius,
+	uint64_t seed = 0, const AntParameters& ant_parameters = AntParameters())
+{
+	std::vector<Colony> colonies;
+	const uint32_t colonies_count = to<uint32_t>(ants_counts.size());
+	colonies.reserve(colonies_count);
+	for (uint32_t i(0); i < colonies_count; ++i) {
+		sf::Vector2f position = center;
+		if (i) {
+			const float angle = 2.0f * PI * to<float>(i - 1) / to<float>(colonies_count - 1);
+			position += ring_radius * sf::Vector2f(cos(angle), sin(angle));
+		}
+		colonies.emplace_back(position.x, position.y, ants_counts[i], seed + i, ant_parameters, to<uint16_t>(i));
+	}
+	return colonies;
+}
+
+// Colonies sharing ants_count evenly, the remainder goes to the first colonies
+inline std::vector<Colony> makeColonies(uint32_t colonies_count, uint32_t ants_count, const sf::Vector2f& center, float ring_radius,
+	uint64_t seed = 0, const AntParameters& ant_parameters = AntParameters())
+{
+	colonies_count = std::max(colonies_count, 1u);
+	std::vector<uint32_t> ants_counts(colonies_count);
+	for (uint32_t i(0); i < colonies_count; ++i) {
+		ants_counts[i] = ants_count / colonies_count + (i < ants_count % colonies_count ? 1 : 0);
+	}
+	return makeColonies(ants_counts, center, ring_radius, seed, ant_parameters);
+}
@@ -16,6 +16,7 @@ struct Conf
 	const static uint32_t WIN_HEIGHT;
 	static std::shared_ptr<sf::Texture> ANT_TEXTURE;
 	static std::shared_ptr<sf::Texture> MARKER_TEXTURE;
+	static std::shared_ptr<sf::Texture> CIRCLE_TEXTURE;
 
 	static void loadTextures()
 	{
@@ -26,11 +27,16 @@ struct Conf
 		Conf::MARKER_TEXTURE = std::make_shared<sf::Texture>();
 		Conf::MARKER_TEXTURE->loadFromFile("res/marker.png");
 		Conf::MARKER_TEXTURE->setSmooth(true);
+
+		Conf::CIRCLE_TEXTURE = std::make_shared<sf::Texture>();
+		Conf::CIRCLE_TEXTURE->loadFromFile("res/circle.png");
+		Conf::CIRCLE_TEXTURE->setSmooth(true);
 	}
 
 	static void freeTextures()
 	{
 		Conf::ANT_TEXTURE = nullptr;
 		Conf::MARKER_TEXTURE = nullptr;
+		Conf::CIRCLE_TEXTURE = nullptr;
 	}
 };
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+
+
+// Stateless counter based generator (Widynski's "Squares"): a number is a pure function of
+// (seed, id, tick, stream) so it can be drawn from any thread, in any order, and computed
+// for many ants at once without sharing any state
+struct CounterRNG
+{
+	enum Stream : uint32_t {
+		InitAngle,
+		InitDirectionTimer,
+		InitMarkerTimer,
+		DirectionNoise,
+		StreamsCount
+	};
+
+	explicit CounterRNG(uint64_t seed_ = 0)
+		: seed(seed_)
+	{
+		for (uint32_t i(0); i < StreamsCount; ++i) {
+			keys[i] = makeKey(seed ^ (0x9E3779B97F4A7C15ULL * (i + 1)));
+		}
+	}
+
+	uint32_t get(uint32_t id, uint32_t tick, Stream stream) const
+	{
+		const uint64_t counter = (static_cast<uint64_t>(tick) << 32) | id;
+		return squares32(counter, keys[stream]);
+	}
+
+	// Uniform in [0, 1)
+	float getUnit(uint32_t id, uint32_t tick, Stream stream) const
+	{
+		return static_cast<float>(get(id, tick, stream) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Uniform in [0, width)
+	float getUnder(float width, uint32_t id, uint32_t tick, Stream stream) const
+	{
+		return width * getUnit(id, tick, stream);
+	}
+
+	// Uniform in [-width, width)
+	float getRange(float width, uint32_t id, uint32_t tick, Stream stream) const
+	{
+		return width * (2.0f * getUnit(id, tick, stream) - 1.0f);
+	}
+
+	static uint32_t squares32(uint64_t counter, uint64_t key)
+	{
+		uint64_t x = counter * key;
+		const uint64_t y = x;
+		const uint64_t z = y + key;
+		x = x * x + y; x = (x >> 32) | (x << 32);
+		x = x * x + z; x = (x >> 32) | (x << 32);
+		x = x * x + y; x = (x >> 32) | (x << 32);
+		return static_cast<uint32_t>((x * x + z) >> 32);
+	}
+
+	// Squares needs keys with well mixed, odd bit patterns
+	static uint64_t makeKey(uint64_t value)
+	{
+		value += 0x9E3779B97F4A7C15ULL;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+		return (value ^ (value >> 31)) | 1u;
+	}
+
+	uint64_t seed;
+	uint64_t keys[StreamsCount];
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "marker.hpp"
+#include "food.hpp"
+
+
+// Hashes of the simulation state. The digest of a set of objects is the wrapping sum of the
+// hashes of its objects: it can be kept up to date as objects come and go, and it does not
+// depend on the order containers keep them in, only on what the simulation computed
+namespace digest
+{
+
+inline uint64_t mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+inline uint64_t combine(uint64_t h, uint64_t value)
+{
+	return mix(h + 0x9E3779B97F4A7C15ULL + value);
+}
+
+// Exact bits, the digest has to change with any change of a value
+inline uint64_t getBits(float f)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+// The vertex slot is left out, it only depends on where the quad ended up in the store
+inline uint64_t getHash(const Marker& m)
+{
+	uint64_t h = combine(getBits(m.position.x), getBits(m.position.y));
+	h = combine(h, getBits(m.intensity));
+	h = combine(h, to<uint64_t>(m.type) | to<uint64_t>(m.permanent) << 8 | to<uint64_t>(m.colony) << 16);
+	return combine(h, m.deposit_tick);
+}
+
+inline uint64_t getHash(const Food& f)
+{
+	uint64_t h = combine(getBits(f.position.x), getBits(f.position.y));
+	h = combine(h, getBits(f.radius));
+	return combine(h, getBits(f.quantity));
+}
+
+}
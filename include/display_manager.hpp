@@ -1,14 +1,15 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
-#include "world.hpp"
-#include "colony.hpp"
+#include <chrono>
+#include "render_snapshot.hpp"
+#include "profiler.hpp"
 
 
 class DisplayManager
 {
 public:
-    DisplayManager(sf::RenderTarget& target, sf::RenderWindow& window, World& world, Colony& colony);
+    DisplayManager(sf::RenderTarget& target, sf::RenderWindow& window);
 
     //offset mutators
     void setOffset(float x, float y) {m_offsetX=x; m_offsetY=y;};
@@ -23,8 +24,12 @@ public:
     // zoom
     void zoom(float zoomFactor) {m_zoom *= zoomFactor;};
 
-    // draw the current world
-    void draw();
+    // draw a state of the world, the marker changes of a snapshot are applied the first time it is drawn
+    void draw(const RenderSnapshot& snapshot);
+
+	// Rolling percentiles of every phase in window coordinates: p50, p95 and p99 bars with their
+	// values, printed to the console every second instead when res/font.ttf is not found
+	void drawProfiler(const Profiler& profiler);
 
 	void processEvents();
 
@@ -38,9 +43,10 @@ public:
 	bool pause;
 	bool draw_markers;
 	bool update;
-	float render_time;
 	bool speed_mode;
 	bool debug_mode;
+	bool save_checkpoint;
+	bool switch_steering;
 
 	sf::Vector2f getClicPosition() const
 	{
@@ -53,8 +59,12 @@ private:
     sf::Texture m_texture;
 	sf::VertexArray m_va;
 
-	World& m_world;
-	Colony& m_colony;
+	MarkerVertexBuffer m_markers;
+	sf::Texture m_field_texture;
+	sf::Font m_font;
+	bool m_font_loaded;
+	std::chrono::steady_clock::time_point m_last_profiler_print;
+	uint64_t m_snapshot_version;
 
 	bool m_mouse_button_pressed;
 	sf::Vector2i m_drag_clic_position, m_clic_position;
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "world.hpp"
+#include "colony.hpp"
+
+
+// Runs the simulation over several worker processes of the same host. The world is split in
+// vertical strips of whole marker cell columns, each owned by one worker that updates the ants
+// standing in it. A worker also keeps ghost columns on each side of its strip, the cells its
+// ants can read or write during a tick, as an exact copy of the neighbour ones.
+// Workers talk to their two neighbours through rings in shared memory, at every tick they:
+//  - update their ants against their cells and ghost cells
+//  - send the changes landing in cells the neighbour holds, then apply all the changes of
+//    their cells in the order of a single process run: colony, chunk of the ant ids, picked
+//    food before markers, ant id
+//  - update the world, then hand the ants that left their strip over to the neighbour
+// Every holder of a cell applies the same operations to it in the same order, so runs give
+// the same result as a single process whatever the number of workers
+namespace domain
+{
+
+// Columns a worker holds on each side of its strip: an ant moves less than a column per
+// tick, then its marker and food queries reach a few columns around the one it stands in
+uint32_t getGhostColumns(const World& world, const std::vector<Colony>& colonies);
+
+struct Strips
+{
+	Strips(const World& world, uint32_t strips_count, uint32_t ghost_columns_);
+
+	// Column of a position, positions on the right edge of the world belong to the last one
+	uint32_t getColumn(float x) const;
+
+	uint32_t getOwner(uint32_t column) const;
+
+	// True if the column is in the strip or in its ghost columns, the world wraps around
+	bool holds(uint32_t strip, uint32_t column) const;
+
+	// Strips sharing cells with strip, without duplicates
+	std::vector<uint32_t> getNeighbours(uint32_t strip) const;
+
+	uint32_t count() const
+	{
+		return to<uint32_t>(first_columns.size()) - 1;
+	}
+
+	// Strips have to be at least that many columns wide so that only neighbours share cells
+	uint32_t getMinStripColumns() const
+	{
+		return 2 * ghost_columns;
+	}
+
+	float column_width;
+	uint32_t columns_count;
+	uint32_t ghost_columns;
+	// Strip i owns the columns [first_columns[i], first_columns[i + 1])
+	std::vector<uint32_t> first_columns;
+};
+
+struct Stats
+{
+	// Ants handed over to another worker, over all the ticks
+	uint64_t migrated_ants = 0;
+	// Bytes of changes and ants sent between workers, over all the ticks
+	uint64_t exchanged_bytes = 0;
+};
+
+// Runs ticks of world and colonies over workers_count processes then merges their state back,
+// as if updateAll and world.update had been called ticks times. threads_count is the size of
+// the pool of each worker, 0 shares the cores between the workers. Returns false when processes
+// cannot be used here, with the pheromone field, when the marker cell size is not a multiple of
+// the food one, when the strips would be narrower than getMinStripColumns or when a worker
+// failed, world and colonies are then left untouched. The counts of the run are added to stats,
+// so that runs split in several calls sum up in the same Stats.
+// Has to be called before any other thread is started: only the calling thread survives a fork
+bool run(World& world, std::vector<Colony>& colonies, uint32_t workers_count, uint32_t ticks, float dt, uint32_t threads_count = 0, Stats* stats = nullptr);
+
+}
@@ -1,28 +1,22 @@
 #pragma once
 #include <SFML/Graphics.hpp>
 #include "config.hpp"
+#include "utils.hpp"
 
 
 struct Food
 {
 	Food() = default;
 
-	Food(float x, float y, float r, float quantity_, Marker* maker_ptr = nullptr)
+	Food(float x, float y, float r, float quantity_)
 		: position(x, y)
 		, radius(r)
 		, quantity(quantity_)
-		, marker(maker_ptr)
 	{}
 
 	void pick()
 	{
 		quantity -= 1.0f;
-		if (isDone()) {
-			if (marker) {
-				marker->intensity = 10.0f;
-				marker->permanent = false;
-			}
-		}
 	}
 
 	bool isDone() const
@@ -30,18 +24,12 @@ struct Food
 		return quantity <= 0.0f;
 	}
 
-	void render(sf::RenderTarget& target, const sf::RenderStates& states) const
+	void render_in(sf::Vertex* quad) const
 	{
-		sf::CircleShape circle(radius);
-		circle.setOrigin(radius, radius);
-		circle.setPosition(position);
-		circle.setFillColor(Conf::FOOD_COLOR);
-
-		target.draw(circle, states);
+		setCircleQuad(quad, position, radius, Conf::FOOD_COLOR);
 	}
 
 	sf::Vector2f position;
 	float radius;
 	float quantity;
-	Marker* marker;
 };
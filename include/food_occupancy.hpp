@@ -0,0 +1,135 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+#include <SFML/System.hpp>
+
+#include "utils.hpp"
+
+
+// Which cells of a grid have an object in their 3x3 neighbourhood, the cells a neighbourhood
+// query like Grid::findAround visits. Like the cells of the grids, counts of the objects around
+// each cell and a bitmap of the non zero ones are allocated by chunks of chunk_side x chunk_side,
+// keyed like Grid::chunks, only where objects are around. One bit per chunk, small enough to stay
+// in cache, tells whether a chunk exists, so a query far from any object costs one bit test and
+// one close to objects a map lookup instead of visiting nine cells
+class FoodOccupancy
+{
+public:
+	static constexpr int32_t chunk_side = 16;
+
+	FoodOccupancy(int32_t width_, int32_t height_)
+		: width(std::max(1, width_))
+		, height(std::max(1, height_))
+		, chunks_width((width + chunk_side - 1) / chunk_side)
+		, chunks_height((height + chunk_side - 1) / chunk_side)
+		, m_chunk_bits((to<uint64_t>(chunks_width) * chunks_height + 63) / 64, 0)
+	{}
+
+	void add(const sf::Vector2i& cell_coords)
+	{
+		forEachAround(cell_coords, [this](const sf::Vector2i& coords) {
+			const uint64_t chunk_index = getChunkIndex(coords);
+			std::unique_ptr<Chunk>& chunk = m_chunks[chunk_index];
+			if (!chunk) {
+				chunk.reset(new Chunk());
+				m_chunk_bits[chunk_index / 64] |= uint64_t(1) << (chunk_index % 64);
+			}
+			const int32_t index = getIndexInChunk(coords);
+			if (!chunk->counts[index]++) {
+				chunk->bits[index / 64] |= uint64_t(1) << (index % 64);
+			}
+			++chunk->objects_count;
+		});
+	}
+
+	void remove(const sf::Vector2i& cell_coords)
+	{
+		forEachAround(cell_coords, [this](const sf::Vector2i& coords) {
+			const uint64_t chunk_index = getChunkIndex(coords);
+			const auto it = m_chunks.find(chunk_index);
+			if (it == m_chunks.end()) {
+				return;
+			}
+			Chunk& chunk = *it->second;
+			const int32_t index = getIndexInChunk(coords);
+			if (!--chunk.counts[index]) {
+				chunk.bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+			}
+			if (!--chunk.objects_count) {
+				m_chunks.erase(it);
+				m_chunk_bits[chunk_index / 64] &= ~(uint64_t(1) << (chunk_index % 64));
+			}
+		});
+	}
+
+	// False only when no object is in the 3x3 cells around, cells out of the grid answer true
+	bool isNear(const sf::Vector2i& cell_coords) const
+	{
+		if (cell_coords.x < 0 || cell_coords.x >= width || cell_coords.y < 0 || cell_coords.y >= height) {
+			return true;
+		}
+		const uint64_t chunk_index = getChunkIndex(cell_coords);
+		if (!((m_chunk_bits[chunk_index / 64] >> (chunk_index % 64)) & 1)) {
+			return false;
+		}
+		const Chunk& chunk = *m_chunks.find(chunk_index)->second;
+		const int32_t index = getIndexInChunk(cell_coords);
+		return (chunk.bits[index / 64] >> (index % 64)) & 1;
+	}
+
+	void clear()
+	{
+		m_chunks.clear();
+		std::fill(m_chunk_bits.begin(), m_chunk_bits.end(), 0);
+	}
+
+	uint64_t getMemory() const
+	{
+		return m_chunk_bits.capacity() * sizeof(uint64_t) + m_chunks.bucket_count() * sizeof(void*)
+			+ m_chunks.size() * (sizeof(Chunk) + sizeof(std::pair<const uint64_t, std::unique_ptr<Chunk>>));
+	}
+
+	uint64_t getChunksCount() const
+	{
+		return m_chunks.size();
+	}
+
+	const int32_t width, height;
+	const int32_t chunks_width, chunks_height;
+
+private:
+	struct Chunk
+	{
+		// Objects in the 3x3 cells around each cell
+		uint32_t counts[chunk_side * chunk_side] = {};
+		uint64_t bits[chunk_side * chunk_side / 64] = {};
+		// Sum of the counts, the chunk is freed when it reaches zero
+		uint64_t objects_count = 0;
+	};
+
+	std::unordered_map<uint64_t, std::unique_ptr<Chunk>> m_chunks;
+	std::vector<uint64_t> m_chunk_bits;
+
+	uint64_t getChunkIndex(const sf::Vector2i& cell_coords) const
+	{
+		return to<uint64_t>(cell_coords.x / chunk_side) + to<uint64_t>(cell_coords.y / chunk_side) * chunks_width;
+	}
+
+	static int32_t getIndexInChunk(const sf::Vector2i& cell_coords)
+	{
+		return (cell_coords.x % chunk_side) + (cell_coords.y % chunk_side) * chunk_side;
+	}
+
+	template<typename Callback>
+	void forEachAround(const sf::Vector2i& cell_coords, Callback&& callback)
+	{
+		for (int32_t y(std::max(0, cell_coords.y - 1)); y < std::min(height, cell_coords.y + 2); ++y) {
+			for (int32_t x(std::max(0, cell_coords.x - 1)); x < std::min(width, cell_coords.x + 2); ++x) {
+				callback(sf::Vector2i(x, y));
+			}
+		}
+	}
+};
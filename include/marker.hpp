@@ -1,6 +1,8 @@
 #pragma once
 #include "config.hpp"
+#include "utils.hpp"
 #include <iostream>
+#include <algorithm>
 
 
 struct Marker
@@ -11,58 +13,62 @@ struct Marker
 	};
 
 	Marker() = default;
-	Marker(const sf::Vector2f& pos, Type type_, float intensity_, bool permanent_ = false)
+	Marker(const sf::Vector2f& pos, Type type_, float intensity_, bool permanent_ = false, uint16_t colony_ = 0)
 		: position(pos)
 		, intensity(intensity_)
 		, type(type_)
 		, permanent(permanent_)
+		, colony(colony_)
+		, deposit_tick(0)
+		, vertex_slot(0xFFFFFFFF)
 	{}
 
-	void update(const float dt)
+	// Markers lose decay_per_tick intensity every tick since their deposit, unless permanent
+	float getIntensity(uint32_t tick, float decay_per_tick) const
 	{
-		if (!permanent) {
-			intensity -= 1.0f * dt;
+		if (permanent) {
+			return intensity;
 		}
+		return intensity - to<float>(tick - deposit_tick) * decay_per_tick;
 	}
 
-	void destroy()
+	bool isDone(uint32_t tick, float decay_per_tick) const
 	{
-		intensity = -1.0f;
+		return getIntensity(tick, decay_per_tick) < 0.0f;
 	}
 
-	bool isDone() const
+	// First tick at which isDone holds, for a marker that is not permanent. Markers that would
+	// last max_age ticks or more, or never fade, expire after max_age ticks
+	uint32_t getExpiryTick(float decay_per_tick) const
 	{
-		return intensity < 0.0f;
-	}
-
-	void render_in(sf::VertexArray& va, const uint32_t index) const
-	{
-		if (!permanent) {
-			const float radius = intensity * 0.15f;
-			
-			sf::Color color = (type == ToHome) ? Conf::TO_HOME_COLOR : Conf::TO_FOOD_COLOR;
-
-			va[index + 0].position = position + sf::Vector2f(radius, 0.0f);
-			va[index + 1].position = position + sf::Vector2f(0.0f, radius);
-			va[index + 2].position = position + sf::Vector2f(-radius, 0.0f);
-			va[index + 3].position = position + sf::Vector2f(0.0f, -radius);
-
-			va[index + 0].color = color;
-			va[index + 1].color = color;
-			va[index + 2].color = color;
-			va[index + 3].color = color;
-
-			constexpr float tex_size = 100.0f;
-			va[index + 0].texCoords = sf::Vector2f(0.0f, 0.0f);
-			va[index + 1].texCoords = sf::Vector2f(tex_size, 0.0f);
-			va[index + 2].texCoords = sf::Vector2f(tex_size, tex_size);
-			va[index + 3].texCoords = sf::Vector2f(0.0f, tex_size);
+		const float ticks = intensity / decay_per_tick;
+		if (!(ticks < static_cast<float>(max_age))) {
+			return deposit_tick + max_age;
+		}
+		// Ages below max_age are exact floats, the estimate is only a few ticks off
+		uint32_t age = to<uint32_t>(std::max(ticks, 0.0f));
+		for (uint32_t step(0); step < max_expiry_steps && age && isDone(deposit_tick + age - 1, decay_per_tick); ++step) {
+			--age;
 		}
+		for (uint32_t step(0); step < max_expiry_steps && !isDone(deposit_tick + age, decay_per_tick); ++step) {
+			++age;
+		}
+		return deposit_tick + age;
 	}
 
+	// About 3 days at 60Hz
+	static constexpr uint32_t max_age = 1u << 24;
+	static constexpr uint32_t max_expiry_steps = 1024;
+
 	sf::Vector2f position;
 	Type type;
 
+	// Intensity at deposit_tick
 	float intensity;
 	bool permanent;
+	// Colony that laid the marker, each colony only follows its own markers
+	uint16_t colony;
+	uint32_t deposit_tick;
+	// Quad of the marker in World::marker_vertices
+	uint32_t vertex_slot;
 };
@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <SFML/System.hpp>
+
+#include "marker.hpp"
+#include "utils.hpp"
+
+
+// Rasterised view of the marker grids read by the sensors of the ants: per channel and texel,
+// the sum of the current intensities of the markers it holds. A fading marker is stored as
+// intensity + decay * deposit_tick, the sum at a tick being the stored one minus the number of
+// fading markers times decay * tick, so markers only touch the raster when added and removed.
+// Sums are fixed point integers: they are exact whatever the order markers come and go in, a
+// rebuilt raster is the same as the one kept up to date.
+// Texels are allocated by chunks of chunk_side x chunk_side when a first marker lands in them and
+// freed with their last marker, memory follows the area holding markers. Chunks are found in a
+// table of one pointer per chunk rather than a map like the grids, a sensor read stays two loads
+class MarkerRaster
+{
+public:
+	static constexpr uint32_t chunk_side = 32;
+
+	MarkerRaster(uint32_t world_width, uint32_t world_height, uint32_t texel_size_, uint32_t channels_count)
+		: texel_size(std::max(1u, texel_size_))
+		, width(std::max(1u, (world_width + texel_size - 1) / texel_size))
+		, height(std::max(1u, (world_height + texel_size - 1) / texel_size))
+		, chunks_width((width + chunk_side - 1) / chunk_side)
+		, chunks_height((height + chunk_side - 1) / chunk_side)
+		, m_chunks(to<uint64_t>(channels_count) * chunks_width * chunks_height)
+		, m_chunks_count(0)
+		, m_decay(0)
+	{}
+
+	// Has to be called with an empty raster
+	void setDecay(float decay_per_tick)
+	{
+		m_decay = toFixed(decay_per_tick);
+	}
+
+	void add(uint32_t channel, const Marker& marker)
+	{
+		const sf::Vector2u coords = getTexelCoords(marker.position);
+		std::unique_ptr<Chunk>& chunk = m_chunks[getChunkIndex(channel, coords)];
+		if (!chunk) {
+			chunk.reset(new Chunk());
+			++m_chunks_count;
+		}
+		Texel& texel = chunk->texels[getIndexInChunk(coords)];
+		texel.sum += getStored(marker);
+		texel.fading += marker.permanent ? 0 : 1;
+		++chunk->markers_count;
+	}
+
+	void remove(uint32_t channel, const Marker& marker)
+	{
+		const sf::Vector2u coords = getTexelCoords(marker.position);
+		std::unique_ptr<Chunk>& chunk = m_chunks[getChunkIndex(channel, coords)];
+		if (!chunk) {
+			return;
+		}
+		Texel& texel = chunk->texels[getIndexInChunk(coords)];
+		texel.sum -= getStored(marker);
+		texel.fading -= marker.permanent ? 0 : 1;
+		if (!--chunk->markers_count) {
+			chunk.reset();
+			--m_chunks_count;
+		}
+	}
+
+	// Markers done but not removed yet would count negatively, sums are clamped to 0
+	float get(uint32_t channel, const sf::Vector2f& position, uint32_t tick) const
+	{
+		const sf::Vector2u coords = getTexelCoords(position);
+		const Chunk* chunk = m_chunks[getChunkIndex(channel, coords)].get();
+		if (!chunk) {
+			return 0.0f;
+		}
+		const Texel& texel = chunk->texels[getIndexInChunk(coords)];
+		const int64_t sum = texel.sum - to<int64_t>(texel.fading) * m_decay * tick;
+		return sum > 0 ? to<float>(sum) * (1.0f / fixed_one) : 0.0f;
+	}
+
+	void clear()
+	{
+		for (std::unique_ptr<Chunk>& chunk : m_chunks) {
+			chunk.reset();
+		}
+		m_chunks_count = 0;
+	}
+
+	uint64_t getMemory() const
+	{
+		return m_chunks.capacity() * sizeof(std::unique_ptr<Chunk>) + m_chunks_count * sizeof(Chunk);
+	}
+
+	uint64_t getChunksCount() const
+	{
+		return m_chunks_count;
+	}
+
+	const uint32_t texel_size;
+	const uint32_t width, height;
+	const uint32_t chunks_width, chunks_height;
+	// Intensity 1 in fixed point
+	static constexpr float fixed_one = 65536.0f;
+
+private:
+	struct Texel
+	{
+		int64_t sum = 0;
+		uint32_t fading = 0;
+	};
+
+	struct Chunk
+	{
+		Texel texels[chunk_side * chunk_side];
+		// Fading and permanent markers of all the texels
+		uint64_t markers_count = 0;
+	};
+
+	// Per channel, null for the chunks without markers
+	std::vector<std::unique_ptr<Chunk>> m_chunks;
+	uint64_t m_chunks_count;
+	int64_t m_decay;
+
+	static int64_t toFixed(float f)
+	{
+		return to<int64_t>(std::llround(to<double>(f) * fixed_one));
+	}
+
+	int64_t getStored(const Marker& marker) const
+	{
+		const int64_t intensity = toFixed(marker.intensity);
+		return marker.permanent ? intensity : intensity + m_decay * marker.deposit_tick;
+	}
+
+	// Positions out of the world read the closest texel
+	sf::Vector2u getTexelCoords(const sf::Vector2f& position) const
+	{
+		const uint32_t x = std::min(width - 1, to<uint32_t>(std::max(0.0f, position.x) / texel_size));
+		const uint32_t y = std::min(height - 1, to<uint32_t>(std::max(0.0f, position.y) / texel_size));
+		return sf::Vector2u(x, y);
+	}
+
+	uint64_t getChunkIndex(uint32_t channel, const sf::Vector2u& coords) const
+	{
+		return (to<uint64_t>(channel) * chunks_height + coords.y / chunk_side) * chunks_width + coords.x / chunk_side;
+	}
+
+	static uint32_t getIndexInChunk(const sf::Vector2u& coords)
+	{
+		return (coords.x % chunk_side) + (coords.y % chunk_side) * chunk_side;
+	}
+};
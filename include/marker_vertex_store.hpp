@@ -0,0 +1,307 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <SFML/Graphics.hpp>
+#include "marker.hpp"
+#include "timing_wheel.hpp"
+
+
+// Marker vertices changed since the previous flush of a MarkerVertexStore, as vertex ranges
+struct MarkerVerticesUpdate
+{
+	struct Range
+	{
+		uint64_t first;
+		uint64_t count;
+	};
+
+	void clear()
+	{
+		vertices_count = 0;
+		ranges.clear();
+		vertices.clear();
+	}
+
+	// Size of the whole vertex array after the update
+	uint64_t vertices_count = 0;
+	std::vector<Range> ranges;
+	// Vertices of the ranges, one after the other
+	std::vector<sf::Vertex> vertices;
+};
+
+
+// Persistent quads of the markers. Each marker gets a slot of 4 vertices when deposited, its
+// colour and texture coordinates are written once and its position only when its radius has
+// shrunk by refresh_radius_step. flush only hands out the slots changed since the previous
+// flush, slots of expired markers are collapsed and reused by the next deposits
+class MarkerVertexStore
+{
+public:
+	static constexpr uint32_t invalid_slot = 0xFFFFFFFF;
+
+	MarkerVertexStore()
+		: m_flush_all(true)
+	{}
+
+	uint32_t add(const Marker& marker, uint32_t tick, float decay_per_tick)
+	{
+		uint32_t slot;
+		if (m_free_slots.empty()) {
+			slot = static_cast<uint32_t>(m_slots.size());
+			m_slots.emplace_back();
+			m_vertices.resize(4 * m_slots.size());
+			m_dirty.push_back(false);
+		}
+		else {
+			slot = m_free_slots.back();
+			m_free_slots.pop_back();
+		}
+
+		m_slots[slot] = Slot{marker.position, marker.intensity, marker.deposit_tick, 0, true};
+
+		const sf::Color color = (marker.type == Marker::ToHome) ? Conf::TO_HOME_COLOR : Conf::TO_FOOD_COLOR;
+		constexpr float tex_size = 100.0f;
+		sf::Vertex* quad = &m_vertices[4 * slot];
+		for (uint32_t i(0); i < 4; ++i) {
+			quad[i].color = color;
+		}
+		quad[0].texCoords = sf::Vector2f(0.0f, 0.0f);
+		quad[1].texCoords = sf::Vector2f(tex_size, 0.0f);
+		quad[2].texCoords = sf::Vector2f(tex_size, tex_size);
+		quad[3].texCoords = sf::Vector2f(0.0f, tex_size);
+
+		refresh(slot, tick, decay_per_tick);
+		return slot;
+	}
+
+	// For a marker whose position, intensity or deposit tick changed
+	void replace(uint32_t slot, const Marker& marker, uint32_t tick, float decay_per_tick)
+	{
+		if (slot == invalid_slot || !m_slots[slot].used) {
+			return;
+		}
+		m_slots[slot].position = marker.position;
+		m_slots[slot].intensity = marker.intensity;
+		m_slots[slot].deposit_tick = marker.deposit_tick;
+		refresh(slot, tick, decay_per_tick);
+	}
+
+	void reserve(uint64_t markers_count)
+	{
+		m_slots.reserve(markers_count);
+		m_vertices.reserve(4 * markers_count);
+		m_dirty.reserve(markers_count);
+		m_dirty_slots.reserve(markers_count);
+	}
+
+	void remove(uint32_t slot)
+	{
+		if (slot == invalid_slot || !m_slots[slot].used) {
+			return;
+		}
+
+		m_slots[slot].used = false;
+		sf::Vertex* quad = &m_vertices[4 * slot];
+		for (uint32_t i(0); i < 4; ++i) {
+			quad[i].position = m_slots[slot].position;
+		}
+		markDirty(slot);
+		m_free_slots.push_back(slot);
+	}
+
+	// Rewrites the positions of the markers whose radius changed enough since their last refresh
+	void update(uint32_t tick, float decay_per_tick)
+	{
+		m_refreshes.process(tick, [&](uint32_t slot) {
+			const Slot& s = m_slots[slot];
+			if (s.used && s.next_refresh_tick == tick) {
+				refresh(slot, tick, decay_per_tick);
+			}
+		});
+	}
+
+	// Forgets all the slots, markers have to be added again
+	void clear()
+	{
+		m_slots.clear();
+		m_vertices.clear();
+		m_free_slots.clear();
+		m_dirty.clear();
+		m_dirty_slots.clear();
+		m_refreshes.clear();
+		m_flush_all = true;
+	}
+
+	// Writes the changed vertices in update, merging close ranges: sending a few clean slots
+	// is cheaper than another upload call
+	void flush(MarkerVerticesUpdate& update)
+	{
+		update.clear();
+		update.vertices_count = m_vertices.size();
+		if (m_flush_all) {
+			if (!m_vertices.empty()) {
+				update.ranges.push_back(MarkerVerticesUpdate::Range{0, m_vertices.size()});
+				update.vertices = m_vertices;
+			}
+			m_flush_all = false;
+			clearDirty();
+			return;
+		}
+
+		constexpr uint32_t max_gap = 16;
+		std::sort(m_dirty_slots.begin(), m_dirty_slots.end());
+		uint64_t i = 0;
+		while (i < m_dirty_slots.size()) {
+			const uint32_t first = m_dirty_slots[i];
+			uint32_t last = first;
+			while (i + 1 < m_dirty_slots.size() && m_dirty_slots[i + 1] - last <= max_gap) {
+				last = m_dirty_slots[++i];
+			}
+			++i;
+
+			const uint64_t count = 4 * (to<uint64_t>(last) - first + 1);
+			update.ranges.push_back(MarkerVerticesUpdate::Range{4 * to<uint64_t>(first), count});
+			update.vertices.insert(update.vertices.end(), m_vertices.begin() + 4 * first, m_vertices.begin() + 4 * first + count);
+		}
+		clearDirty();
+	}
+
+	uint64_t getSlotsCount() const
+	{
+		return m_slots.size();
+	}
+
+	const std::vector<sf::Vertex>& getVertices() const
+	{
+		return m_vertices;
+	}
+
+	// Radius lost between two position refreshes of a marker, in pixels
+	static constexpr float refresh_radius_step = 0.25f;
+	static constexpr float radius_per_intensity = 0.15f;
+
+private:
+	struct Slot
+	{
+		sf::Vector2f position;
+		float intensity;
+		uint32_t deposit_tick;
+		uint32_t next_refresh_tick;
+		bool used;
+	};
+
+	std::vector<Slot> m_slots;
+	std::vector<sf::Vertex> m_vertices;
+	std::vector<uint32_t> m_free_slots;
+	std::vector<bool> m_dirty;
+	std::vector<uint32_t> m_dirty_slots;
+	TimingWheel<uint32_t> m_refreshes;
+	bool m_flush_all;
+
+	void refresh(uint32_t slot, uint32_t tick, float decay_per_tick)
+	{
+		Slot& s = m_slots[slot];
+		const float age = to<float>(tick - s.deposit_tick);
+		const float radius = std::max(0.0f, (s.intensity - age * decay_per_tick) * radius_per_intensity);
+
+		sf::Vertex* quad = &m_vertices[4 * slot];
+		quad[0].position = s.position + sf::Vector2f(radius, 0.0f);
+		quad[1].position = s.position + sf::Vector2f(0.0f, radius);
+		quad[2].position = s.position + sf::Vector2f(-radius, 0.0f);
+		quad[3].position = s.position + sf::Vector2f(0.0f, -radius);
+		markDirty(slot);
+
+		const uint32_t ticks_per_step = std::max(1u, to<uint32_t>(refresh_radius_step / (radius_per_intensity * decay_per_tick)));
+		s.next_refresh_tick = tick + ticks_per_step;
+		m_refreshes.schedule(s.next_refresh_tick, slot);
+	}
+
+	void markDirty(uint32_t slot)
+	{
+		if (!m_dirty[slot]) {
+			m_dirty[slot] = true;
+			m_dirty_slots.push_back(slot);
+		}
+	}
+
+	void clearDirty()
+	{
+		for (uint32_t slot : m_dirty_slots) {
+			m_dirty[slot] = false;
+		}
+		m_dirty_slots.clear();
+	}
+};
+
+
+// GPU side copy of the marker vertices, fed with the updates of a MarkerVertexStore. Uses a
+// stream sf::VertexBuffer when available and draws the vertices from memory otherwise
+class MarkerVertexBuffer
+{
+public:
+	MarkerVertexBuffer()
+		: uploaded_vertices(0)
+		, m_buffer(sf::Quads, sf::VertexBuffer::Stream)
+		, m_use_buffer(false)
+		, m_buffer_checked(false)
+	{}
+
+	// Has to be called from the thread drawing
+	void apply(const MarkerVerticesUpdate& update)
+	{
+		if (!m_buffer_checked) {
+			m_use_buffer = sf::VertexBuffer::isAvailable();
+			m_buffer_checked = true;
+		}
+
+		m_vertices.resize(update.vertices_count);
+		uint64_t source = 0;
+		for (const MarkerVerticesUpdate::Range& range : update.ranges) {
+			std::copy(update.vertices.begin() + source, update.vertices.begin() + source + range.count, m_vertices.begin() + range.first);
+			source += range.count;
+		}
+
+		uploaded_vertices = 0;
+		if (!m_use_buffer || m_vertices.empty()) {
+			return;
+		}
+
+		// The whole array is sent again when the buffer has to grow
+		if (m_buffer.getVertexCount() < m_vertices.size()) {
+			m_buffer.create(m_vertices.capacity());
+			m_buffer.update(m_vertices.data(), m_vertices.size(), 0);
+			uploaded_vertices = m_vertices.size();
+			return;
+		}
+
+		source = 0;
+		for (const MarkerVerticesUpdate::Range& range : update.ranges) {
+			m_buffer.update(&update.vertices[source], range.count, to<uint32_t>(range.first));
+			source += range.count;
+			uploaded_vertices += range.count;
+		}
+	}
+
+	void draw(sf::RenderTarget& target, const sf::RenderStates& states) const
+	{
+		if (m_vertices.empty()) {
+			return;
+		}
+
+		if (m_use_buffer) {
+			target.draw(m_buffer, 0, m_vertices.size(), states);
+		}
+		else {
+			target.draw(m_vertices.data(), m_vertices.size(), sf::Quads, states);
+		}
+	}
+
+	// Vertices sent to the GPU by the last apply
+	uint64_t uploaded_vertices;
+
+private:
+	std::vector<sf::Vertex> m_vertices;
+	sf::VertexBuffer m_buffer;
+	bool m_use_buffer;
+	bool m_buffer_checked;
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <SFML/System.hpp>
+
+#include "utils.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "digest.hpp"
+
+
+// Dense alternative to the marker grids: one float raster per marker channel, with texels of
+// texel_size pixels. Deposits are added to the texel under them and every update evaporates
+// and diffuses the whole raster of the channels that ever received something, so memory and
+// update cost only depend on the size of the world and the resolution, not on the number of
+// ants laying trails
+class PheromoneField
+{
+public:
+	PheromoneField(uint32_t world_width, uint32_t world_height, uint32_t texel_size_, uint32_t channels_count)
+		: texel_size(std::max(1u, texel_size_))
+		, width(std::max(1u, (world_width + texel_size - 1) / texel_size))
+		, height(std::max(1u, (world_height + texel_size - 1) / texel_size))
+		, evaporation_rate(default_evaporation_rate)
+		, diffusion(default_diffusion)
+		, min_value(default_min_value)
+		, m_values(to<uint64_t>(channels_count) * width * height, 0.0f)
+		, m_next(m_values.size(), 0.0f)
+		, m_active(channels_count, 0)
+	{}
+
+	void deposit(uint32_t channel, const sf::Vector2f& position, float amount)
+	{
+		m_values[getIndex(channel, getTexelX(position.x), getTexelY(position.y))] += amount;
+		m_active[channel] = 1;
+	}
+
+	float get(uint32_t channel, uint32_t x, uint32_t y) const
+	{
+		return m_values[getIndex(channel, x, y)];
+	}
+
+	// Value of the texel under position, positions out of the world read the closest texel
+	float getAt(uint32_t channel, const sf::Vector2f& position) const
+	{
+		return m_values[getIndex(channel, getTexelX(position.x), getTexelY(position.y))];
+	}
+
+	// Calls callback(texel_center, value) for the non empty texels whose center is closer than
+	// radius to position and in front of direction, returns the number of texels looked at.
+	// Each row only visits the chord of the disc it crosses
+	template<typename Callback>
+	uint32_t forEachInHalfDisc(uint32_t channel, const sf::Vector2f& position, const sf::Vector2f& direction, float radius, Callback&& callback) const
+	{
+		const float t = to<float>(texel_size);
+		const float* values = &m_values[getIndex(channel, 0, 0)];
+		const int32_t y_min = std::max(0, to<int32_t>(std::ceil((position.y - radius) / t - 0.5f)));
+		const int32_t y_max = std::min(to<int32_t>(height) - 1, to<int32_t>(std::floor((position.y + radius) / t - 0.5f)));
+		uint32_t examined = 0;
+		for (int32_t y(y_min); y <= y_max; ++y) {
+			const float dy = (to<float>(y) + 0.5f) * t - position.y;
+			const float half_chord_2 = radius * radius - dy * dy;
+			if (half_chord_2 <= 0.0f) {
+				continue;
+			}
+			const float half_chord = std::sqrt(half_chord_2);
+			const int32_t x_min = std::max(0, to<int32_t>(std::ceil((position.x - half_chord) / t - 0.5f)));
+			const int32_t x_max = std::min(to<int32_t>(width) - 1, to<int32_t>(std::floor((position.x + half_chord) / t - 0.5f)));
+			const float* row = values + to<uint64_t>(y) * width;
+			for (int32_t x(x_min); x <= x_max; ++x) {
+				++examined;
+				const float value = row[x];
+				if (value > 0.0f) {
+					const sf::Vector2f center((to<float>(x) + 0.5f) * t, (to<float>(y) + 0.5f) * t);
+					const sf::Vector2f to_texel = center - position;
+					if (dot(to_texel, direction) > 0.0f && to_texel.x * to_texel.x + to_texel.y * to_texel.y < radius * radius) {
+						callback(center, value);
+					}
+				}
+			}
+		}
+		return examined;
+	}
+
+	// Explicit 5 point diffusion then exponential evaporation, texels falling under min_value
+	// are cleared. Edges reflect so diffusion alone keeps the total. Bands of rows are updated
+	// in parallel into the second buffer, each texel only reads the previous state so the
+	// result does not depend on the number of threads
+	void update(float dt, ThreadPool* pool = nullptr)
+	{
+		// Above a quarter the explicit scheme is unstable
+		const float k = std::min(0.25f, diffusion * dt / to<float>(texel_size * texel_size));
+		const float keep = std::exp(-evaporation_rate * dt);
+
+		m_jobs.clear();
+		for (uint32_t channel(0); channel < m_active.size(); ++channel) {
+			if (m_active[channel]) {
+				for (uint32_t y(0); y < height; y += band_rows) {
+					m_jobs.push_back(Job{channel, y, std::min(height, y + band_rows)});
+				}
+			}
+		}
+
+		const auto run_job = [&](uint32_t i) {
+			const Job& job = m_jobs[i];
+			for (uint32_t y(job.begin); y < job.end; ++y) {
+				updateRow(job.channel, y, k, keep);
+			}
+		};
+		if (pool) {
+			pool->parallelFor(to<uint32_t>(m_jobs.size()), run_job);
+		}
+		else {
+			for (uint32_t i(0); i < m_jobs.size(); ++i) {
+				run_job(i);
+			}
+		}
+		// Inactive channels are all zero in both buffers
+		m_values.swap(m_next);
+	}
+
+	bool isActive(uint32_t channel) const
+	{
+		return m_active[channel];
+	}
+
+	uint64_t getMemory() const
+	{
+		return (m_values.capacity() + m_next.capacity()) * sizeof(float) + m_active.capacity();
+	}
+
+	uint64_t getTexelsCount() const
+	{
+		return to<uint64_t>(width) * height;
+	}
+
+	// Hash of the exact content of every texel, the position of a value is part of its hash
+	uint64_t getDigest() const
+	{
+		uint64_t result = 0;
+		for (uint64_t i(0); i < m_values.size(); ++i) {
+			if (m_values[i] != 0.0f) {
+				result += digest::combine(i, digest::getBits(m_values[i]));
+			}
+		}
+		return result;
+	}
+
+	void clear()
+	{
+		std::fill(m_values.begin(), m_values.end(), 0.0f);
+		std::fill(m_next.begin(), m_next.end(), 0.0f);
+		std::fill(m_active.begin(), m_active.end(), 0);
+	}
+
+	const uint32_t texel_size;
+	const uint32_t width, height;
+	// Fraction of the pheromone lost per second is 1 - exp(-evaporation_rate)
+	float evaporation_rate;
+	// Diffusion coefficient in square pixels per second
+	float diffusion;
+	float min_value;
+
+	static constexpr float default_evaporation_rate = 0.1f;
+	static constexpr float default_diffusion = 16.0f;
+	static constexpr float default_min_value = 0.1f;
+	static constexpr uint32_t band_rows = 32;
+
+private:
+	struct Job
+	{
+		uint32_t channel;
+		uint32_t begin, end;
+	};
+
+	std::vector<float> m_values;
+	std::vector<float> m_next;
+	std::vector<uint8_t> m_active;
+	std::vector<Job> m_jobs;
+
+	uint64_t getIndex(uint32_t channel, uint32_t x, uint32_t y) const
+	{
+		return (to<uint64_t>(channel) * height + y) * width + x;
+	}
+
+	uint32_t getTexelX(float x) const
+	{
+		return std::min(width - 1, to<uint32_t>(std::max(0.0f, x) / texel_size));
+	}
+
+	uint32_t getTexelY(float y) const
+	{
+		return std::min(height - 1, to<uint32_t>(std::max(0.0f, y) / texel_size));
+	}
+
+	// The same operations in the same order for every texel, packs and the scalar edges give
+	// the same bits
+	template<typename V>
+	static typename V::Float getNext(typename V::Float center, typename V::Float left, typename V::Float right, typename V::Float up,
+		typename V::Float down, float k, float keep, float min_value)
+	{
+		const auto neighbours = V::add(V::add(left, right), V::add(up, down));
+		const auto laplacian = V::sub(neighbours, V::mul(V::set(4.0f), center));
+		const auto value = V::mul(V::set(keep), V::add(center, V::mul(V::set(k), laplacian)));
+		return V::select(V::lt(value, V::set(min_value)), V::set(0.0f), value);
+	}
+
+	void updateRow(uint32_t channel, uint32_t y, float k, float keep)
+	{
+		const float* row = &m_values[getIndex(channel, 0, y)];
+		const float* up = &m_values[getIndex(channel, 0, y ? y - 1 : y)];
+		const float* down = &m_values[getIndex(channel, 0, y + 1 < height ? y + 1 : y)];
+		float* out = &m_next[getIndex(channel, 0, y)];
+
+		if (width == 1) {
+			out[0] = getNext<simd::Scalar>(row[0], row[0], row[0], up[0], down[0], k, keep, min_value);
+			return;
+		}
+		out[0] = getNext<simd::Scalar>(row[0], row[0], row[1], up[0], down[0], k, keep, min_value);
+		simd::forEachPack(1, width - 1, [&](auto pack, uint64_t x) {
+			using V = decltype(pack);
+			V::store(&out[x], getNext<V>(V::load(&row[x]), V::load(&row[x - 1]), V::load(&row[x + 1]), V::load(&up[x]), V::load(&down[x]), k, keep, min_value));
+		});
+		const uint32_t last = width - 1;
+		out[last] = getNext<simd::Scalar>(row[last], row[last - 1], row[last], up[last], down[last], k, keep, min_value);
+	}
+};
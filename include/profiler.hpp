@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+
+// Milliseconds spent in each phase. Simulation phases are summed over the ticks covered,
+// ant update and colony check over all the threads running them
+struct PhaseTimes
+{
+	enum Phase : uint32_t {
+		ProcessEvents,
+		AntUpdate,
+		CheckColony,
+		ApplyChanges,
+		MarkerExpiry,
+		MarkerDecay,
+		VertexGeneration,
+		Draw,
+		Display,
+		// Wall time of the whole frame
+		Frame,
+		PhasesCount
+	};
+
+	PhaseTimes()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		std::fill(ms, ms + PhasesCount, 0.0f);
+		ticks = 0;
+	}
+
+	void add(const PhaseTimes& other)
+	{
+		for (uint32_t i(0); i < PhasesCount; ++i) {
+			ms[i] += other.ms[i];
+		}
+		ticks += other.ticks;
+	}
+
+	static const char* getName(Phase phase)
+	{
+		static const char* names[PhasesCount] = {
+			"process_events",
+			"ant_update",
+			"check_colony",
+			"apply_changes",
+			"marker_expiry",
+			"marker_decay",
+			"vertex_generation",
+			"draw",
+			"display",
+			"frame"
+		};
+		return names[phase];
+	}
+
+	float ms[PhasesCount];
+	// Simulation ticks covered
+	uint32_t ticks;
+};
+
+
+// Adds the time until its destruction to a phase, does not even read the clock without times
+class ScopedTimer
+{
+public:
+	ScopedTimer(PhaseTimes* times, PhaseTimes::Phase phase)
+		: m_times(times)
+		, m_phase(phase)
+	{
+		if (m_times) {
+			m_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~ScopedTimer()
+	{
+		if (m_times) {
+			m_times->ms[m_phase] += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+		}
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	PhaseTimes* m_times;
+	const PhaseTimes::Phase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+
+// Keeps the phase times of the last frames for rolling percentiles and optionally writes
+// every frame as a CSV row
+class Profiler
+{
+public:
+	explicit Profiler(uint32_t window_size = 240)
+		: m_frames(window_size)
+		, m_frames_count(0)
+	{}
+
+	// Returns false if the file cannot be written, frames are then only kept in memory
+	bool openCsv(const std::string& path)
+	{
+		m_csv.open(path, std::ios::trunc);
+		if (!m_csv) {
+			return false;
+		}
+		m_csv << "frame,ticks";
+		for (uint32_t i(0); i < PhasesCount; ++i) {
+			m_csv << ',' << PhaseTimes::getName(static_cast<PhaseTimes::Phase>(i)) << "_ms";
+		}
+		m_csv << '\n';
+		return true;
+	}
+
+	void addFrame(const PhaseTimes& times)
+	{
+		m_frames[m_frames_count % m_frames.size()] = times;
+		if (m_csv.is_open()) {
+			m_csv << m_frames_count << ',' << times.ticks;
+			for (uint32_t i(0); i < PhasesCount; ++i) {
+				m_csv << ',' << times.ms[i];
+			}
+			m_csv << '\n';
+		}
+		++m_frames_count;
+	}
+
+	// p in [0, 1], over the frames of the window
+	float getPercentile(PhaseTimes::Phase phase, float p) const
+	{
+		const uint64_t count = std::min<uint64_t>(m_frames_count, m_frames.size());
+		if (!count) {
+			return 0.0f;
+		}
+		m_values.resize(count);
+		for (uint64_t i(0); i < count; ++i) {
+			m_values[i] = m_frames[i].ms[phase];
+		}
+		const uint64_t rank = std::min(count - 1, static_cast<uint64_t>(p * count));
+		std::nth_element(m_values.begin(), m_values.begin() + rank, m_values.end());
+		return m_values[rank];
+	}
+
+	uint64_t getFramesCount() const
+	{
+		return m_frames_count;
+	}
+
+	static constexpr uint32_t PhasesCount = PhaseTimes::PhasesCount;
+
+private:
+	std::vector<PhaseTimes> m_frames;
+	uint64_t m_frames_count;
+	std::ofstream m_csv;
+	mutable std::vector<float> m_values;
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "marker_vertex_store.hpp"
+#include "profiler.hpp"
+
+
+// Everything needed to draw one state of the simulation, written by the simulation thread and
+// then only read by the render thread
+struct RenderSnapshot
+{
+	std::vector<sf::Vertex> ants;
+	std::vector<sf::Vertex> carried_food;
+	std::vector<sf::Vertex> food;
+	// Marker vertices changed since the previous snapshot, to be applied in publication order
+	MarkerVerticesUpdate markers;
+	// RGBA texels of the pheromone field, empty with discrete markers
+	std::vector<sf::Uint8> field_pixels;
+	sf::Vector2u field_size;
+	uint32_t field_texel_size = 0;
+
+	sf::Vector2f world_size;
+	// One nest per colony, the ants of the colonies are one after the other in ants
+	std::vector<sf::Vector2f> colony_positions;
+	float colony_size = 0.0f;
+	uint32_t tick = 0;
+	// Simulation phases since the previous snapshot
+	PhaseTimes phase_times;
+	// Incremented by each publication, 0 means nothing was published yet
+	uint64_t version = 0;
+};
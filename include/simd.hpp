@@ -0,0 +1,141 @@
+#pragma once
+#include <cstdint>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+// Minimal float packs used by the batch kernels. Kernels are written once against the pack
+// interface and instantiated with the widest pack available plus the scalar one for the tail.
+// No fused multiply-add is used so that every pack width gives bit-identical results
+namespace simd
+{
+
+struct Scalar
+{
+	using Float = float;
+	using Mask = bool;
+	static constexpr uint32_t width = 1;
+
+	static Float load(const float* p) { return *p; }
+	static void store(float* p, Float v) { *p = v; }
+	static Float set(float f) { return f; }
+	static Float add(Float a, Float b) { return a + b; }
+	static Float sub(Float a, Float b) { return a - b; }
+	static Float mul(Float a, Float b) { return a * b; }
+	static Float min(Float a, Float b) { return b < a ? b : a; }
+	static Float max(Float a, Float b) { return a < b ? b : a; }
+	static Mask lt(Float a, Float b) { return a < b; }
+	static Mask gt(Float a, Float b) { return a > b; }
+	static Mask both(Mask a, Mask b) { return a && b; }
+	static Mask either(Mask a, Mask b) { return a || b; }
+	// mask ? a : b
+	static Float select(Mask m, Float a, Float b) { return m ? a : b; }
+	// Round to nearest, valid for |f| < 2^22
+	static Float round(Float f) { return (f + 12582912.0f) - 12582912.0f; }
+};
+
+#if defined(__AVX2__) || defined(__AVX__)
+
+struct Avx
+{
+	using Float = __m256;
+	using Mask = __m256;
+	static constexpr uint32_t width = 8;
+
+	static Float load(const float* p) { return _mm256_loadu_ps(p); }
+	static void store(float* p, Float v) { _mm256_storeu_ps(p, v); }
+	static Float set(float f) { return _mm256_set1_ps(f); }
+	static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	static Float min(Float a, Float b) { return _mm256_min_ps(b, a); }
+	static Float max(Float a, Float b) { return _mm256_max_ps(b, a); }
+	static Mask lt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static Mask gt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+	static Mask either(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+	static Float select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); }
+	static Float round(Float f) { return _mm256_sub_ps(_mm256_add_ps(f, set(12582912.0f)), set(12582912.0f)); }
+};
+
+using Wide = Avx;
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+struct Sse
+{
+	using Float = __m128;
+	using Mask = __m128;
+	static constexpr uint32_t width = 4;
+
+	static Float load(const float* p) { return _mm_loadu_ps(p); }
+	static void store(float* p, Float v) { _mm_storeu_ps(p, v); }
+	static Float set(float f) { return _mm_set1_ps(f); }
+	static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float min(Float a, Float b) { return _mm_min_ps(b, a); }
+	static Float max(Float a, Float b) { return _mm_max_ps(b, a); }
+	static Mask lt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+	static Mask gt(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+	static Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+	static Mask either(Mask a, Mask b) { return _mm_or_ps(a, b); }
+	static Float select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	static Float round(Float f) { return _mm_sub_ps(_mm_add_ps(f, set(12582912.0f)), set(12582912.0f)); }
+};
+
+using Wide = Sse;
+
+#else
+
+using Wide = Scalar;
+
+#endif
+
+// Sine and cosine of x using the Cephes single precision polynomials after reducing x to
+// [-pi/4, pi/4]. Valid for |x| < 6e6, the reduction loses accuracy beyond
+template<typename V>
+inline void sinCos(typename V::Float x, typename V::Float& sin_x, typename V::Float& cos_x)
+{
+	const auto quadrant = V::round(V::mul(x, V::set(0.63661977236f)));
+	auto r = V::sub(x, V::mul(quadrant, V::set(1.5703125f)));
+	r = V::sub(r, V::mul(quadrant, V::set(4.837512969970703125e-4f)));
+	r = V::sub(r, V::mul(quadrant, V::set(7.54978995489188216e-8f)));
+	const auto z = V::mul(r, r);
+
+	auto s = V::add(V::mul(V::set(-1.9515295891e-4f), z), V::set(8.3321608736e-3f));
+	s = V::add(V::mul(s, z), V::set(-1.6666654611e-1f));
+	s = V::add(V::mul(V::mul(s, z), r), r);
+
+	auto c = V::add(V::mul(V::set(2.443315711809948e-5f), z), V::set(-1.388731625493765e-3f));
+	c = V::add(V::mul(c, z), V::set(4.166664568298827e-2f));
+	c = V::add(V::sub(V::set(1.0f), V::mul(V::set(0.5f), z)), V::mul(V::mul(c, z), z));
+
+	// Quadrant modulo 4, as an integer valued float
+	const auto j = V::sub(quadrant, V::mul(V::set(4.0f), V::round(V::sub(V::mul(quadrant, V::set(0.25f)), V::set(0.375f)))));
+	const auto swap = V::either(V::both(V::gt(j, V::set(0.5f)), V::lt(j, V::set(1.5f))), V::gt(j, V::set(2.5f)));
+	const auto sin_negative = V::gt(j, V::set(1.5f));
+	const auto cos_negative = V::both(V::gt(j, V::set(0.5f)), V::lt(j, V::set(2.5f)));
+
+	const auto zero = V::set(0.0f);
+	const auto sin_abs = V::select(swap, c, s);
+	const auto cos_abs = V::select(swap, s, c);
+	sin_x = V::select(sin_negative, V::sub(zero, sin_abs), sin_abs);
+	cos_x = V::select(cos_negative, V::sub(zero, cos_abs), cos_abs);
+}
+
+// Calls kernel(Pack(), i) on [begin, end), with i advancing by Pack::width
+template<typename Kernel>
+void forEachPack(uint64_t begin, uint64_t end, Kernel&& kernel)
+{
+	uint64_t i = begin;
+	for (; i + Wide::width <= end; i += Wide::width) {
+		kernel(Wide(), i);
+	}
+	for (; i < end; ++i) {
+		kernel(Scalar(), i);
+	}
+}
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <vector>
+#include "world.hpp"
+#include "colony.hpp"
+#include "thread_pool.hpp"
+#include "render_snapshot.hpp"
+#include "trajectory.hpp"
+
+
+// Runs the simulation on its own thread with a fixed time step. The render thread never
+// touches the world: it gets snapshots through three buffers, the simulation fills the back
+// one and publishes it as the ready one, the render thread swaps the ready one with the one
+// it draws. A new snapshot is only built once the previous one was taken, so the marker
+// updates they carry are all applied and in order.
+// World modifications from other threads go through post and run between two ticks
+class Simulation
+{
+public:
+	// threads_count is the size of the pool updating the colonies, 0 means one thread per core
+	Simulation(World& world, std::vector<Colony>& colonies, float dt = 0.016f, uint32_t threads_count = 0);
+	~Simulation();
+
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+
+	void start();
+	void stop();
+
+	void post(const std::function<void()>& command);
+
+	void setPause(bool pause)
+	{
+		m_pause = pause;
+	}
+
+	// Runs the ticks as fast as possible instead of in real time
+	void setSpeedMode(bool speed_mode)
+	{
+		m_speed_mode = speed_mode;
+	}
+
+	// Records the ants of the first colony after every tick, has to be set before start
+	void setRecorder(trajectory::Recorder* recorder)
+	{
+		m_recorder = recorder;
+	}
+
+	// Takes the last published snapshot, returns false when there is no new one
+	bool acquireSnapshot();
+
+	const RenderSnapshot& getSnapshot() const
+	{
+		return *m_front;
+	}
+
+	float getTicksPerSecond() const
+	{
+		return m_ticks_per_second;
+	}
+
+private:
+	World& m_world;
+	std::vector<Colony>& m_colonies;
+	ThreadPool m_thread_pool;
+	const float m_dt;
+	trajectory::Recorder* m_recorder;
+
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+	std::atomic<bool> m_pause;
+	std::atomic<bool> m_speed_mode;
+	std::atomic<float> m_ticks_per_second;
+	// Phases of the ticks run since the last publication
+	PhaseTimes m_phase_times;
+
+	std::mutex m_commands_mutex;
+	std::vector<std::function<void()>> m_commands;
+
+	std::mutex m_snapshot_mutex;
+	std::unique_ptr<RenderSnapshot> m_back, m_ready, m_front;
+	bool m_ready_available;
+	std::atomic<bool> m_snapshot_requested;
+	uint64_t m_version;
+
+	void run();
+	void runCommands();
+	void publish();
+};
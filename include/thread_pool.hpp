@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+
+// Fixed set of workers running index based jobs, the calling thread takes part in the work
+class ThreadPool
+{
+public:
+	// 0 means one thread per hardware core
+	explicit ThreadPool(uint32_t threads_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Calls callback(i) for every i in [0, count) and returns once all calls are done.
+	// Indices are handed out dynamically so callback must not rely on which thread runs it
+	template<typename Callback>
+	void parallelFor(uint32_t count, Callback&& callback)
+	{
+		if (m_workers.empty() || count < 2) {
+			for (uint32_t i(0); i < count; ++i) {
+				callback(i);
+			}
+			return;
+		}
+
+		const std::function<void(uint32_t)> job(callback);
+		run(count, job);
+	}
+
+	uint32_t getThreadsCount() const
+	{
+		return static_cast<uint32_t>(m_workers.size()) + 1;
+	}
+
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_start_cv, m_done_cv;
+
+	const std::function<void(uint32_t)>* m_job;
+	std::atomic<uint32_t> m_next_index;
+	uint32_t m_count;
+	uint32_t m_active_workers;
+	uint64_t m_generation;
+	bool m_stop;
+
+	void run(uint32_t count, const std::function<void(uint32_t)>& job);
+	void runJobs();
+	void workerLoop();
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+
+// Hashed timing wheel: each entry is stored in the slot of its tick modulo the number of slots,
+// so processing a tick only looks at the entries of one slot. Entries scheduled more than one
+// turn ahead simply wait in their slot until their tick comes. Ticks have to be processed in
+// order, entries scheduled for a tick already processed go to the next one
+template<typename T>
+struct TimingWheel
+{
+	explicit TimingWheel(uint32_t slots_count_log2 = 12)
+		: slots(1u << slots_count_log2)
+		, mask((1u << slots_count_log2) - 1)
+		, size(0)
+		, next_tick(0)
+	{}
+
+	void schedule(uint32_t tick, const T& value)
+	{
+		// Their slot would only be looked at one turn later
+		if (static_cast<int32_t>(tick - next_tick) < 0) {
+			tick = next_tick;
+		}
+		slots[tick & mask].push_back(Entry{tick, value});
+		++size;
+	}
+
+	// Calls callback on the values scheduled for tick, or before it, and removes them
+	template<typename Callback>
+	void process(uint32_t tick, Callback&& callback)
+	{
+		std::vector<Entry>& slot = slots[tick & mask];
+		uint64_t i = 0;
+		while (i < slot.size()) {
+			if (static_cast<int32_t>(slot[i].tick - tick) <= 0) {
+				const T value = slot[i].value;
+				slot[i] = slot.back();
+				slot.pop_back();
+				--size;
+				callback(value);
+			}
+			else {
+				++i;
+			}
+		}
+		next_tick = tick + 1;
+	}
+
+	// next_tick_ is the next tick process will be called with
+	void clear(uint32_t next_tick_ = 0)
+	{
+		next_tick = next_tick_;
+		for (std::vector<Entry>& slot : slots) {
+			slot.clear();
+		}
+		size = 0;
+	}
+
+	struct Entry
+	{
+		uint32_t tick;
+		T value;
+	};
+
+	std::vector<std::vector<Entry>> slots;
+	const uint32_t mask;
+	uint64_t size;
+	uint32_t next_tick;
+};
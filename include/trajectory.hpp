@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "world.hpp"
+#include "colony.hpp"
+
+
+// Ant trajectories file: a header followed by independent chunks of consecutive ticks.
+// The first tick of a chunk holds absolute values, the next ones deltas. For every tick:
+//  - the tick delta, then for every ant the x and y deltas of its position quantized to
+//    position_step, as zigzag varints, and its heading as one byte
+//  - the phases of the ants as a bitmap
+// Headings are diamond angles, (0, 4] turned into a byte, so no trigonometry is needed
+namespace trajectory
+{
+
+constexpr char magic[8] = {'A', 'N', 'T', 'S', 'I', 'M', 'T', 'R'};
+constexpr uint32_t version = 1;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t ants_count;
+	float world_width;
+	float world_height;
+	float colony_x;
+	float colony_y;
+	float colony_size;
+	float position_step;
+	uint32_t ticks_per_chunk;
+	uint32_t reserved;
+};
+
+struct ChunkHeader
+{
+	uint32_t first_tick;
+	uint32_t ticks_count;
+	uint32_t payload_size;
+	uint32_t reserved;
+};
+
+
+// Encodes the ants state of every recorded tick on the calling thread and leaves the file
+// writes to a background thread. At most max_queued_chunks chunks wait for the writer:
+// when it lags behind, completed chunks are dropped and counted instead of blocking the
+// caller. Chunks being independent, a dropped chunk only leaves a gap in the ticks
+class Recorder
+{
+public:
+	Recorder();
+	~Recorder();
+
+	Recorder(const Recorder&) = delete;
+	Recorder& operator=(const Recorder&) = delete;
+
+	bool open(const std::string& path, const World& world, const Colony& colony, uint32_t ticks_per_chunk = 64, uint32_t max_queued_chunks = 8);
+	// Writes the chunk in progress and waits for the writer to finish
+	void close();
+
+	void record(const Ants& ants, uint32_t tick);
+
+	uint64_t getDroppedChunks() const
+	{
+		return m_dropped_chunks;
+	}
+
+	uint64_t getWrittenBytes() const
+	{
+		return m_written_bytes;
+	}
+
+private:
+	struct Chunk
+	{
+		ChunkHeader header;
+		std::vector<uint8_t> payload;
+	};
+
+	std::ofstream m_file;
+	Header m_header;
+	uint32_t m_max_queued_chunks;
+	uint32_t m_last_tick;
+	std::vector<int32_t> m_last_x, m_last_y;
+	Chunk m_chunk;
+
+	std::thread m_writer;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<Chunk> m_queue;
+	// Payload buffers given back by the writer, so that recording does not allocate
+	std::vector<std::vector<uint8_t>> m_free_payloads;
+	bool m_stop;
+
+	std::atomic<uint64_t> m_dropped_chunks;
+	std::atomic<uint64_t> m_written_bytes;
+
+	void submitChunk();
+	void writerLoop();
+};
+
+
+// Reads the ticks of a trajectories file one after the other
+class Reader
+{
+public:
+	bool open(const std::string& path);
+
+	const Header& getHeader() const
+	{
+		return m_header;
+	}
+
+	// Sets the position, heading vector and phase of the ants to the next recorded tick,
+	// returns false at the end of the file or when the data of the tick is missing or corrupt
+	bool readTick(Ants& ants, uint32_t& tick);
+
+	// Goes back to the first tick
+	void rewind();
+
+private:
+	std::ifstream m_file;
+	uint64_t m_file_size;
+	Header m_header;
+	ChunkHeader m_chunk;
+	std::vector<uint8_t> m_payload;
+	uint64_t m_offset;
+	uint32_t m_chunk_tick;
+	uint32_t m_tick;
+	std::vector<int32_t> m_x, m_y;
+
+	bool readChunk();
+};
+
+}
@@ -6,12 +6,6 @@
 constexpr float PI = 3.14159265f;
 
 
-float getRandRange(float width);
-
-
-float getRandUnder(float width);
-
-
 template<typename T>
 float getLength(const sf::Vector2<T>& v)
 {
@@ -33,3 +27,7 @@ float dot(const sf::Vector2f& v1, const sf::Vector2f& v2);
 
 
 float sign(const float f);
+
+
+// Writes the 4 vertices of a quad showing a disc of the circle texture
+void setCircleQuad(sf::Vertex* quad, const sf::Vector2f& center, float radius, const sf::Color& color);
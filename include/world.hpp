@@ -1,83 +1,362 @@
 #pragma once
-#include <list>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
 #include <SFML/System.hpp>
 
 #include "marker.hpp"
 #include "food.hpp"
 #include "utils.hpp"
-
-
+#include "timing_wheel.hpp"
+#include "marker_vertex_store.hpp"
+#include "profiler.hpp"
+#include "digest.hpp"
+#include "pheromone_field.hpp"
+#include "marker_raster.hpp"
+#include "food_occupancy.hpp"
+#include "thread_pool.hpp"
+
+
+// Objects sorted in square cells. Cells are allocated by chunks of chunk_side x chunk_side
+// cells when an object is first added in them, and chunks are freed once their last object
+// is removed, so memory follows the occupied area rather than the size of the world.
+// A cell is identified by its index, see getIndexFromCoords.
+// Radius queries go through a stencil, the offsets of the cells a disc of stencil_radius
+// centered anywhere in a cell can reach, built once by setStencilRadius
 template<typename T>
 struct Grid
 {
-	Grid(int32_t width_, int32_t height_, uint32_t cell_size_)
-		: cell_size(cell_size_)
-		, width(width_ / cell_size_)
-		, height(height_ / cell_size_)
+	static constexpr int32_t chunk_side = 16;
+
+	struct Chunk
 	{
-		cells.resize(width * height);
-	}
+		std::vector<T> cells[chunk_side * chunk_side];
+		uint64_t objects_count = 0;
+	};
+
+	Grid(int32_t width_, int32_t height_, uint32_t cell_size_, uint32_t max_per_cell_ = Conf::MAX_MARKERS_PER_CELL)
+		: width(width_ / cell_size_)
+		, height(height_ / cell_size_)
+		, cell_size(cell_size_)
+		, chunks_width((width + chunk_side - 1) / chunk_side)
+		, max_per_cell(max_per_cell_)
+		, stencil_radius(0.0f)
+	{}
 
 	T* add(const T& obj)
 	{
 		return add(getCellCoords(obj.position), obj);
 	}
 
-	std::list<T>* getAt(const sf::Vector2f& position)
+	// Returns nullptr when the cell holds nothing or is outside of the grid
+	std::vector<T>* getAt(const sf::Vector2f& position)
 	{
 		const sf::Vector2i cell_coords = getCellCoords(position);
-
 		if (checkCell(cell_coords)) {
-			return &cells[getIndexFromCoords(cell_coords)];
+			return getCell(getIndexFromCoords(cell_coords));
 		}
-
 		return nullptr;
 	}
 
-	std::list<T*> getAllAt(const sf::Vector2f& position)
+	std::vector<T>* getCell(uint64_t cell_index)
+	{
+		const sf::Vector2i cell_coords = getCoordsFromIndex(cell_index);
+		Chunk* chunk = findChunk(getChunkIndex(cell_coords));
+		return chunk ? &chunk->cells[getIndexInChunk(cell_coords)] : nullptr;
+	}
+
+	// Visits every object in the 3x3 cells block around position without allocating.
+	// The chunk of the previous cell is kept since neighbour cells mostly share it
+	template<typename Callback>
+	void forEachAround(const sf::Vector2f& position, Callback&& callback)
+	{
+		findAround(position, [&](T& obj) {
+			callback(obj);
+			return false;
+		});
+	}
+
+	// Returns the first object around position matching pred, or nullptr
+	template<typename Predicate>
+	T* findAround(const sf::Vector2f& position, Predicate&& pred)
 	{
-		std::list<T*> result(0);
 		const sf::Vector2i cell_coords = getCellCoords(position);
-		
+		uint64_t cached_index = invalid_chunk;
+		Chunk* chunk = nullptr;
+
 		for (int32_t x(-1); x < 2; ++x) {
 			for (int32_t y(-1); y < 2; ++y) {
 				const sf::Vector2i coords = cell_coords + sf::Vector2i(x, y);
 				if (checkCell(coords)) {
-					const uint64_t index = getIndexFromCoords(coords);
-					for (T& m : cells[index]) {
-						result.push_back(&m);
+					const uint64_t chunk_index = getChunkIndex(coords);
+					if (chunk_index != cached_index) {
+						chunk = findChunk(chunk_index);
+						cached_index = chunk_index;
+					}
+					if (chunk) {
+						for (T& obj : chunk->cells[getIndexInChunk(coords)]) {
+							if (pred(obj)) {
+								return &obj;
+							}
+						}
 					}
 				}
 			}
 		}
 
-		return result;
+		return nullptr;
+	}
+
+	void setStencilRadius(float radius)
+	{
+		stencil_radius = std::min(radius, getMaxStencilRadius());
+		stencil.clear();
+		const int32_t reach = getStencilReach();
+		for (int32_t y(-reach); y <= reach; ++y) {
+			for (int32_t x(-reach); x <= reach; ++x) {
+				// Distance between the closest points of the center cell and of this one
+				const float gap_x = to<float>(std::max(std::abs(x) - 1, 0) * cell_size);
+				const float gap_y = to<float>(std::max(std::abs(y) - 1, 0) * cell_size);
+				if (gap_x * gap_x + gap_y * gap_y < radius * radius) {
+					stencil.emplace_back(x, y);
+				}
+			}
+		}
+	}
+
+	// Only rebuilds the stencil when radius does not fit in it, not thread safe
+	void reserveStencilRadius(float radius)
+	{
+		if (std::min(radius, getMaxStencilRadius()) > stencil_radius) {
+			setStencilRadius(radius);
+		}
+	}
+
+	// Stencils are narrower than a chunk so that a query spans at most 2x2 chunks
+	float getMaxStencilRadius() const
+	{
+		return to<float>((chunk_side / 2 - 1) * cell_size);
+	}
+
+	// Cells the stencil spans on each side of the center one
+	int32_t getStencilReach() const
+	{
+		return to<int32_t>(std::ceil(stencil_radius / to<float>(cell_size)));
+	}
+
+	// Visits the objects of the cells that can hold points closer than radius to position and in
+	// front of it, dot(point - position, direction) > 0. Whole cells out of the half disc are skipped
+	// with a distance and a plane test, callback still has to test the objects it gets.
+	// radius cannot be larger than stencil_radius
+	template<typename Callback>
+	void forEachInHalfDisc(const sf::Vector2f& position, const sf::Vector2f& direction, float radius, Callback&& callback)
+	{
+		// Keeps cells whose closest point is on the boundary, rounding cannot drop an object
+		constexpr float slack = 1.0f / 1024.0f;
+		const float max_distance = (radius + slack) * (radius + slack);
+		const float size = to<float>(cell_size);
+		const float half_extent = 0.5f * size * (std::abs(direction.x) + std::abs(direction.y));
+		const sf::Vector2i cell_coords = getCellCoords(position);
+
+		// See getMaxStencilRadius, the chunks are looked up once
+		const int32_t reach = getStencilReach();
+		const sf::Vector2i first_chunk((std::max(cell_coords.x - reach, 0)) / chunk_side, (std::max(cell_coords.y - reach, 0)) / chunk_side);
+		Chunk* near_chunks[2][2];
+		for (int32_t y(0); y < 2; ++y) {
+			for (int32_t x(0); x < 2; ++x) {
+				const sf::Vector2i chunk_coords = first_chunk + sf::Vector2i(x, y);
+				const bool inside = chunk_coords.x < chunks_width && chunk_coords.y * chunk_side < height;
+				near_chunks[y][x] = inside ? findChunk(to<uint64_t>(chunk_coords.x) + to<uint64_t>(chunk_coords.y) * chunks_width) : nullptr;
+			}
+		}
+
+		for (const sf::Vector2i& offset : stencil) {
+			const sf::Vector2i coords = cell_coords + offset;
+			if (!checkCell(coords)) {
+				continue;
+			}
+
+			Chunk* chunk = near_chunks[coords.y / chunk_side - first_chunk.y][coords.x / chunk_side - first_chunk.x];
+			if (!chunk) {
+				continue;
+			}
+
+			const sf::Vector2f cell_min(to<float>(coords.x) * size, to<float>(coords.y) * size);
+			const float dx = std::max(std::max(cell_min.x - position.x, position.x - cell_min.x - size), 0.0f);
+			const float dy = std::max(std::max(cell_min.y - position.y, position.y - cell_min.y - size), 0.0f);
+			// The highest dot product over the cell is at its center plus the projected half extent
+			const sf::Vector2f to_center = cell_min + sf::Vector2f(0.5f * size, 0.5f * size) - position;
+			if (dx * dx + dy * dy > max_distance || to_center.x * direction.x + to_center.y * direction.y + half_extent < -slack) {
+				continue;
+			}
+
+			for (T& obj : chunk->cells[getIndexInChunk(coords)]) {
+				callback(obj);
+			}
+		}
 	}
 
+	// Collects pointers to the objects around position into result, reusing its storage
+	void getAllAt(const sf::Vector2f& position, std::vector<T*>& result)
+	{
+		result.clear();
+		forEachAround(position, [&](T& obj) { result.push_back(&obj); });
+	}
+
+	// The returned pointer is only valid until the next insertion or removal in the same cell
 	T* add(const sf::Vector2i& cell_coords, const T& obj)
 	{
 		if (checkCell(cell_coords)) {
-			std::list<T>& l = cells[getIndexFromCoords(cell_coords)];
-			if (Conf::MAX_MARKERS_PER_CELL > l.size()) {
-				l.emplace_back(obj);
-				return &l.back();
+			std::unique_ptr<Chunk>& chunk = chunks[getChunkIndex(cell_coords)];
+			if (!chunk) {
+				chunk.reset(new Chunk());
+			}
+			std::vector<T>& cell = chunk->cells[getIndexInChunk(cell_coords)];
+			if (max_per_cell > cell.size()) {
+				cell.push_back(obj);
+				++chunk->objects_count;
+				return &cell.back();
 			}
 		}
 		return nullptr;
 	}
 
-	bool checkCell(const sf::Vector2i& cell_coords)
+	// Replaces the objects of the cell by the count objects at objects, returns false when the
+	// cell is outside of the grid or cannot hold them
+	bool assign(const sf::Vector2i& cell_coords, const T* objects, uint32_t count)
+	{
+		if (!checkCell(cell_coords) || count > max_per_cell) {
+			return false;
+		}
+		std::unique_ptr<Chunk>& chunk = chunks[getChunkIndex(cell_coords)];
+		if (!chunk) {
+			chunk.reset(new Chunk());
+		}
+		std::vector<T>& cell = chunk->cells[getIndexInChunk(cell_coords)];
+		chunk->objects_count += count;
+		chunk->objects_count -= cell.size();
+		cell.assign(objects, objects + count);
+		return true;
+	}
+
+	// Removes all objects of the cell matching pred by moving the last object of the cell in
+	// place of the removed one, the order of a cell is therefore not preserved
+	template<typename Predicate>
+	uint64_t removeIf(uint64_t cell_index, Predicate&& pred)
+	{
+		const sf::Vector2i cell_coords = getCoordsFromIndex(cell_index);
+		const uint64_t chunk_index = getChunkIndex(cell_coords);
+		Chunk* chunk = findChunk(chunk_index);
+		if (!chunk) {
+			return 0;
+		}
+
+		std::vector<T>& cell = chunk->cells[getIndexInChunk(cell_coords)];
+		uint64_t removed = 0;
+		uint64_t i = 0;
+		while (i < cell.size()) {
+			if (pred(cell[i])) {
+				cell[i] = cell.back();
+				cell.pop_back();
+				++removed;
+			}
+			else {
+				++i;
+			}
+		}
+
+		chunk->objects_count -= removed;
+		if (!chunk->objects_count) {
+			chunks.erase(chunk_index);
+		}
+		return removed;
+	}
+
+	template<typename Predicate>
+	uint64_t removeIf(Predicate&& pred)
+	{
+		std::vector<uint64_t> cell_indexes;
+		forEachCell([&](uint64_t cell_index, const std::vector<T>&) { cell_indexes.push_back(cell_index); });
+
+		uint64_t removed = 0;
+		for (uint64_t cell_index : cell_indexes) {
+			removed += removeIf(cell_index, pred);
+		}
+		return removed;
+	}
+
+	// Calls callback(cell_index, cell) on every allocated cell holding objects, in no particular order
+	template<typename Callback>
+	void forEachCell(Callback&& callback)
+	{
+		for (auto& chunk : chunks) {
+			for (int32_t i(0); i < chunk_side * chunk_side; ++i) {
+				std::vector<T>& cell = chunk.second->cells[i];
+				if (!cell.empty()) {
+					callback(getCellIndex(chunk.first, i), cell);
+				}
+			}
+		}
+	}
+
+	template<typename Callback>
+	void forEachCell(Callback&& callback) const
+	{
+		for (const auto& chunk : chunks) {
+			for (int32_t i(0); i < chunk_side * chunk_side; ++i) {
+				const std::vector<T>& cell = chunk.second->cells[i];
+				if (!cell.empty()) {
+					callback(getCellIndex(chunk.first, i), cell);
+				}
+			}
+		}
+	}
+
+	// Chunks and the storage of their cells
+	uint64_t getMemory() const
+	{
+		uint64_t bytes = 0;
+		for (const auto& chunk : chunks) {
+			bytes += sizeof(Chunk);
+			for (const std::vector<T>& cell : chunk.second->cells) {
+				bytes += cell.capacity() * sizeof(T);
+			}
+		}
+		return bytes;
+	}
+
+	uint64_t getObjectsCount() const
+	{
+		uint64_t count = 0;
+		for (const auto& chunk : chunks) {
+			count += chunk.second->objects_count;
+		}
+		return count;
+	}
+
+	void clear()
+	{
+		chunks.clear();
+	}
+
+	bool checkCell(const sf::Vector2i& cell_coords) const
 	{
 		return cell_coords.x > -1 && cell_coords.x < width && cell_coords.y > -1 && cell_coords.y < height;
 	}
 
-	uint64_t getIndexFromCoords(const sf::Vector2i& cell_coords)
+	uint64_t getIndexFromCoords(const sf::Vector2i& cell_coords) const
 	{
-		return cell_coords.x + cell_coords.y * width;
+		return to<uint64_t>(cell_coords.x) + to<uint64_t>(cell_coords.y) * width;
 	}
 
-	sf::Vector2i getCellCoords(const sf::Vector2f& position)
+	sf::Vector2i getCoordsFromIndex(uint64_t cell_index) const
+	{
+		return sf::Vector2i(to<int32_t>(cell_index % width), to<int32_t>(cell_index / width));
+	}
+
+	sf::Vector2i getCellCoords(const sf::Vector2f& position) const
 	{
 		const int32_t x_cell = to<int32_t>(position.x / cell_size);
 		const int32_t y_cell = to<int32_t>(position.y / cell_size);
@@ -85,125 +364,633 @@ struct Grid
 		return sf::Vector2i(x_cell, y_cell);
 	}
 
-	std::vector<std::list<T>> cells;
-
 	const int32_t width, height, cell_size;
+	const int32_t chunks_width;
+	// Objects added to a full cell are dropped
+	const uint32_t max_per_cell;
+	// Only the chunks holding objects, each cell owns a contiguous array
+	std::unordered_map<uint64_t, std::unique_ptr<Chunk>> chunks;
+	float stencil_radius;
+	std::vector<sf::Vector2i> stencil;
+
+private:
+	static constexpr uint64_t invalid_chunk = ~uint64_t(0);
+
+	uint64_t getChunkIndex(const sf::Vector2i& cell_coords) const
+	{
+		return to<uint64_t>(cell_coords.x / chunk_side) + to<uint64_t>(cell_coords.y / chunk_side) * chunks_width;
+	}
+
+	static int32_t getIndexInChunk(const sf::Vector2i& cell_coords)
+	{
+		return (cell_coords.x % chunk_side) + (cell_coords.y % chunk_side) * chunk_side;
+	}
+
+	uint64_t getCellIndex(uint64_t chunk_index, int32_t index_in_chunk) const
+	{
+		const int32_t x = to<int32_t>(chunk_index % chunks_width) * chunk_side + index_in_chunk % chunk_side;
+		const int32_t y = to<int32_t>(chunk_index / chunks_width) * chunk_side + index_in_chunk / chunk_side;
+		return getIndexFromCoords(sf::Vector2i(x, y));
+	}
+
+	Chunk* findChunk(uint64_t chunk_index) const
+	{
+		const auto it = chunks.find(chunk_index);
+		return it == chunks.end() ? nullptr : it->second.get();
+	}
 };
 
 
+// World modifications produced while ants are updated in parallel, applied at the end of the tick
+struct WorldChanges
+{
+	std::vector<Marker> markers;
+	std::vector<Food*> picked_food;
+	// Id of the ant behind each change, to order changes coming from several processes
+	std::vector<uint32_t> marker_ants;
+	std::vector<uint32_t> picked_food_ants;
+	// Markers looked at by the marker queries of the ants
+	uint64_t examined_markers = 0;
+	uint64_t marker_queries = 0;
+
+	void clear()
+	{
+		markers.clear();
+		picked_food.clear();
+		marker_ants.clear();
+		picked_food_ants.clear();
+		examined_markers = 0;
+		marker_queries = 0;
+	}
+};
+
+
+// Markers are not updated every tick: their intensity is computed from their deposit tick when
+// needed. Each marker schedules its cell in marker_expiries for the tick it expires at, and
+// exhausted food schedules its cell in food_expiries, so an update only visits the cells
+// holding something that expires during this tick
 struct World
 {
-	World(uint32_t width, uint32_t height)
-		: grid_markers_home(width, height, 45)
-		, grid_markers_food(width, height, 45)
-		, grid_food(width, height, 5)
-		, size(to<float>(width), to<float>(height))
-		, va(sf::Quads)
-	{}
+	// Cell of one of the marker grids
+	struct MarkerCell
+	{
+		uint32_t channel;
+		uint64_t index;
+	};
+
+	// Each colony has its own two marker channels. Grids being sparse, a channel only costs
+	// memory where its colony actually laid markers. All the channels share marker_cell_size:
+	// worker processes split the world in columns of marker cells that have to line up in every
+	// grid, and checkpoints store a single size
+	World(uint32_t width, uint32_t height, uint32_t colonies_count = 1, uint32_t marker_cell_size = default_marker_cell_size)
+		: size(to<float>(width), to<float>(height))
+		, grid_food(width, height, food_cell_size)
+		, food_occupancy(grid_food.width, grid_food.height)
+		, markers_count(0)
+		, tick(0)
+		, decay_per_tick(default_decay_per_tick)
+		, expired_markers(0)
+		, expired_food(0)
+		, markers_digest(0)
+		, food_digest(0)
+		, coalesce_radius(0.0f)
+		, coalesce_max_intensity(default_coalesce_max_intensity)
+		, coalesced_markers(0)
+	{
+		for (uint32_t i(0); i < 2 * std::max(colonies_count, 1u); ++i) {
+			marker_grids.emplace_back(width, height, marker_cell_size, getMaxMarkersPerCell(marker_cell_size));
+		}
+	}
 
 	void removeExpiredMarkers()
 	{
-		// Home
-		for (std::list<Marker>& l : grid_markers_home.cells) {
-			l.remove_if([&](const Marker& m) {return m.isDone(); });
+		marker_expiries.process(tick, [this](const MarkerCell& cell) {
+			expired_markers += removeExpiredMarkers(marker_grids[cell.channel], cell.index);
+		});
+	}
+
+	uint64_t removeExpiredMarkers(Grid<Marker>& grid, uint64_t cell_index)
+	{
+		const uint64_t removed = grid.removeIf(cell_index, [this](const Marker& m) {
+			if (isDone(m)) {
+				marker_vertices.remove(m.vertex_slot);
+				markers_digest -= digest::getHash(m);
+				removeFromRaster(m);
+				return true;
+			}
+			return false;
+		});
+		markers_count -= removed;
+		return removed;
+	}
+
+	void removeExpiredFood()
+	{
+		food_expiries.process(tick, [this](uint64_t cell_index) {
+			expired_food += grid_food.removeIf(cell_index, [&](const Food& f) {
+				if (f.isDone()) {
+					releaseFoodMarker(f.position);
+					food_digest -= digest::getHash(f);
+					food_occupancy.remove(grid_food.getCoordsFromIndex(cell_index));
+					return true;
+				}
+				return false;
+			});
+		});
+	}
+
+	// Turns the permanent markers laid by addFoodAt into regular fading ones
+	void releaseFoodMarker(const sf::Vector2f& position)
+	{
+		for (uint32_t colony(0); colony < getColoniesCount(); ++colony) {
+			Grid<Marker>& grid = getGrid(colony, Marker::ToFood);
+			std::vector<Marker>* cell = grid.getAt(position);
+			if (!cell) {
+				continue;
+			}
+			if (field) {
+				const uint64_t cell_index = grid.getIndexFromCoords(grid.getCellCoords(position));
+				grid.removeIf(cell_index, [&](const Marker& m) {
+					if (m.permanent && m.position == position) {
+						markers_digest -= digest::getHash(m);
+						removeFromRaster(m);
+						return true;
+					}
+					return false;
+				});
+				field->deposit(getChannel(colony, Marker::ToFood), position, 10.0f);
+				continue;
+			}
+			for (Marker& m : *cell) {
+				if (m.permanent && m.position == position) {
+					markers_digest -= digest::getHash(m);
+					removeFromRaster(m);
+					m.intensity = 10.0f;
+					m.deposit_tick = tick;
+					m.permanent = false;
+					m.vertex_slot = marker_vertices.add(m, tick, decay_per_tick);
+					markers_digest += digest::getHash(m);
+					addToRaster(m);
+					++markers_count;
+					scheduleExpiry(m);
+					break;
+				}
+			}
 		}
-		// Food
-		for (std::list<Marker>& l : grid_markers_food.cells) {
-			l.remove_if([&](const Marker& m) {return m.isDone(); });
+	}
+
+	void scheduleExpiry(const Marker& marker)
+	{
+		const uint32_t channel = getChannel(marker.colony, marker.type);
+		const Grid<Marker>& grid = marker_grids[channel];
+		const uint64_t index = grid.getIndexFromCoords(grid.getCellCoords(marker.position));
+		marker_expiries.schedule(marker.getExpiryTick(decay_per_tick), MarkerCell{channel, index});
+	}
+
+	// Expiry ticks depend on the time step, they all have to be computed again when it changes
+	void rescheduleExpiries()
+	{
+		marker_expiries.clear(tick);
+		for (const Grid<Marker>& grid : marker_grids) {
+			grid.forEachCell([this](uint64_t, const std::vector<Marker>& cell) {
+				for (const Marker& m : cell) {
+					if (!m.permanent) {
+						scheduleExpiry(m);
+					}
+				}
+			});
 		}
 	}
 
-	void removeExpiredFood()
+	// Rebuilds everything derived from the grids content: markers count, vertex slots, expiries, digests
+	// and marker raster
+	void rebuildIndexes()
 	{
-		for (std::list<Food>& l : grid_food.cells) {
-			l.remove_if([&](const Food& m) {return m.isDone(); });
+		rebuildRaster();
+		markers_digest = computeMarkersDigest();
+		food_digest = computeFoodDigest();
+
+		uint64_t stored_markers = 0;
+		for (const Grid<Marker>& grid : marker_grids) {
+			stored_markers += grid.getObjectsCount();
+		}
+		marker_vertices.clear();
+		marker_vertices.reserve(stored_markers);
+		markers_count = 0;
+		for (Grid<Marker>& grid : marker_grids) {
+			grid.forEachCell([this](uint64_t, std::vector<Marker>& cell) {
+				for (Marker& m : cell) {
+					if (!m.permanent) {
+						m.vertex_slot = marker_vertices.add(m, tick, decay_per_tick);
+						++markers_count;
+					}
+				}
+			});
 		}
+		rescheduleExpiries();
+
+		food_expiries.clear(tick);
+		food_occupancy.clear();
+		grid_food.forEachCell([this](uint64_t cell_index, const std::vector<Food>& cell) {
+			for (uint64_t i(0); i < cell.size(); ++i) {
+				food_occupancy.add(grid_food.getCoordsFromIndex(cell_index));
+			}
+			for (const Food& f : cell) {
+				if (f.isDone()) {
+					food_expiries.schedule(tick, cell_index);
+					break;
+				}
+			}
+		});
+	}
+
+	// The pool, when given, runs the bands of the pheromone field update
+	void update(const float dt, PhaseTimes* times = nullptr, ThreadPool* pool = nullptr)
+	{
+		if (1.0f * dt != decay_per_tick) {
+			decay_per_tick = 1.0f * dt;
+			rescheduleExpiries();
+			rebuildRaster();
+		}
+
+		{
+			ScopedTimer timer(times, PhaseTimes::MarkerExpiry);
+			expired_markers = 0;
+			expired_food = 0;
+			removeExpiredFood();
+			removeExpiredMarkers();
+		}
+
+		++tick;
+		ScopedTimer timer(times, PhaseTimes::MarkerDecay);
+		if (field) {
+			field->update(dt, pool);
+		}
+		else {
+			marker_vertices.update(tick, decay_per_tick);
+		}
+	}
+
+	float getIntensity(const Marker& marker) const
+	{
+		return marker.getIntensity(tick, decay_per_tick);
 	}
 
-	void update(const float dt)
+	bool isDone(const Marker& marker) const
 	{
-		removeExpiredMarkers();
-		removeExpiredFood();
+		return marker.isDone(tick, decay_per_tick);
+	}
 
-		markers_count = 0u;
-		for (std::list<Marker>& l : grid_markers_home.cells) {
-			for (Marker& m : l) {
-				markers_count += m.permanent ? 0 : 1;
-				m.update(dt);
+	// With coalescing, a fading marker is merged into the closest one of its cell within
+	// coalesce_radius, which is then returned. With the pheromone field only permanent markers
+	// are stored, fading ones are deposited into the field and nullptr is returned
+	Marker* addMarker(const Marker& marker)
+	{
+		if (field && !marker.permanent) {
+			field->deposit(getChannel(marker.colony, marker.type), marker.position, marker.intensity);
+			return nullptr;
+		}
+
+		if (coalesce_radius > 0.0f && !marker.permanent) {
+			Marker* merged = coalesceMarker(marker);
+			if (merged) {
+				return merged;
 			}
 		}
 
-		for (std::list<Marker>& l : grid_markers_food.cells) {
-			for (Marker& m : l) {
-				markers_count += m.permanent ? 0 : 1;
-				m.update(dt);
+		Marker* added = getGrid(marker.colony, marker.type).add(marker);
+		if (added) {
+			added->deposit_tick = tick;
+			markers_digest += digest::getHash(*added);
+			addToRaster(*added);
+			if (!added->permanent) {
+				added->vertex_slot = marker_vertices.add(*added, tick, decay_per_tick);
+				++markers_count;
+				scheduleExpiry(*added);
 			}
 		}
+		return added;
 	}
 
-	Marker* addMarker(const Marker& marker)
+	// The merged marker gets the sum of both current intensities, up to coalesce_max_intensity, and
+	// the position of their intensity weighted mean. It is deposited again at this tick so its
+	// expiry is scheduled again, the previous one only visits its cell for nothing
+	Marker* coalesceMarker(const Marker& marker)
+	{
+		Grid<Marker>& grid = getGrid(marker.colony, marker.type);
+		std::vector<Marker>* cell = grid.getAt(marker.position);
+		if (!cell) {
+			return nullptr;
+		}
+
+		Marker* closest = nullptr;
+		float closest_distance = coalesce_radius * coalesce_radius;
+		for (Marker& m : *cell) {
+			const sf::Vector2f to_marker = m.position - marker.position;
+			const float distance = to_marker.x * to_marker.x + to_marker.y * to_marker.y;
+			if (distance < closest_distance && !m.permanent && !isDone(m)) {
+				closest = &m;
+				closest_distance = distance;
+			}
+		}
+		if (!closest) {
+			return nullptr;
+		}
+
+		markers_digest -= digest::getHash(*closest);
+		removeFromRaster(*closest);
+		const float intensity = getIntensity(*closest);
+		const float total = intensity + marker.intensity;
+		if (total > 0.0f) {
+			// Rounding must not move the marker out of the cell holding it
+			const sf::Vector2f position = (intensity * closest->position + marker.intensity * marker.position) / total;
+			if (grid.getCellCoords(position) == grid.getCellCoords(closest->position)) {
+				closest->position = position;
+			}
+		}
+		closest->intensity = std::min(total, coalesce_max_intensity);
+		closest->deposit_tick = tick;
+		marker_vertices.replace(closest->vertex_slot, *closest, tick, decay_per_tick);
+		markers_digest += digest::getHash(*closest);
+		addToRaster(*closest);
+		scheduleExpiry(*closest);
+		++coalesced_markers;
+		return closest;
+	}
+
+	// Bytes held by the marker grids, their vertices, the pheromone field and the marker raster
+	uint64_t getMarkersMemory() const
+	{
+		uint64_t bytes = marker_vertices.getSlotsCount() * 4 * sizeof(sf::Vertex);
+		if (field) {
+			bytes += field->getMemory();
+		}
+		if (marker_raster) {
+			bytes += marker_raster->getMemory();
+		}
+		for (const Grid<Marker>& grid : marker_grids) {
+			bytes += grid.getMemory();
+		}
+		return bytes;
+	}
+
+	// Changes have to be applied in the same order whatever the number of threads for runs to be reproducible
+	void apply(const WorldChanges& changes)
+	{
+		for (Food* food : changes.picked_food) {
+			pickFood(*food);
+		}
+
+		for (const Marker& marker : changes.markers) {
+			addMarker(marker);
+		}
+	}
+
+	// Exhausted food stays in its cell until the update of the tick
+	void pickFood(Food& food)
 	{
-		return getGrid(marker.type).add(marker);
+		food_digest -= digest::getHash(food);
+		food.pick();
+		food_digest += digest::getHash(food);
+		if (food.isDone()) {
+			food_expiries.schedule(tick, grid_food.getIndexFromCoords(grid_food.getCellCoords(food.position)));
+		}
 	}
 
+	// Draws the world directly, only when the world is not displayed through render snapshots
 	void render(sf::RenderTarget& target, const sf::RenderStates& states, bool draw_markers = true) const
 	{
+		if (field && draw_markers) {
+			writeFieldPixels(field_pixels);
+			if (field_texture.getSize() != sf::Vector2u(field->width, field->height)) {
+				field_texture.create(field->width, field->height);
+			}
+			field_texture.update(field_pixels.data());
+			sf::Sprite sprite(field_texture);
+			sprite.setScale(to<float>(field->texel_size), to<float>(field->texel_size));
+			target.draw(sprite, states);
+		}
+
+		marker_vertices.flush(marker_update);
+		marker_buffer.apply(marker_update);
 		if (draw_markers) {
-			va.resize(4 * markers_count);
-			generateMarkersVertexArray(va);
 			sf::RenderStates rs = states;
 			rs.texture = &(*Conf::MARKER_TEXTURE);
-			target.draw(va, rs);
+			marker_buffer.draw(target, rs);
 		}
 
-		for (const std::list<Food>& l : grid_food.cells) {
-			for (const Food& f : l) {
-				f.render(target, states);
+		writeFoodVertices(food_vertices);
+		sf::RenderStates rs = states;
+		rs.texture = &(*Conf::CIRCLE_TEXTURE);
+		target.draw(food_vertices.data(), food_vertices.size(), sf::Quads, rs);
+	}
+
+	void writeFoodVertices(std::vector<sf::Vertex>& vertices) const
+	{
+		vertices.resize(4 * grid_food.getObjectsCount());
+		uint64_t index = 0;
+		grid_food.forEachCell([&](uint64_t, const std::vector<Food>& cell) {
+			for (const Food& f : cell) {
+				f.render_in(&vertices[4 * (index++)]);
 			}
-		}
+		});
 	}
 
-	void generateMarkersVertexArray(sf::VertexArray& va) const
+	// RGBA texels of the pheromone field, the trails of all the colonies blended with the marker colors
+	void writeFieldPixels(std::vector<sf::Uint8>& pixels) const
 	{
-		uint32_t current_index = 0;
-		for (const std::list<Marker>& l : grid_markers_home.cells) {
-			for (const Marker& m : l) {
-				if (!m.permanent) {
-					m.render_in(va, 4 * (current_index++));
+		const uint32_t colonies_count = getColoniesCount();
+		pixels.resize(4 * field->getTexelsCount());
+		for (uint32_t y(0); y < field->height; ++y) {
+			for (uint32_t x(0); x < field->width; ++x) {
+				float to_home = 0.0f;
+				float to_food = 0.0f;
+				for (uint32_t colony(0); colony < colonies_count; ++colony) {
+					to_home += field->get(getChannel(colony, Marker::ToHome), x, y);
+					to_food += field->get(getChannel(colony, Marker::ToFood), x, y);
+				}
+				const float total = to_home + to_food;
+				sf::Uint8* pixel = &pixels[4 * (to<uint64_t>(y) * field->width + x)];
+				if (total <= 0.0f) {
+					pixel[0] = pixel[1] = pixel[2] = pixel[3] = 0;
+					continue;
 				}
+				const float home_ratio = to_home / total;
+				pixel[0] = to<sf::Uint8>(home_ratio * Conf::TO_HOME_COLOR.r + (1.0f - home_ratio) * Conf::TO_FOOD_COLOR.r);
+				pixel[1] = to<sf::Uint8>(home_ratio * Conf::TO_HOME_COLOR.g + (1.0f - home_ratio) * Conf::TO_FOOD_COLOR.g);
+				pixel[2] = to<sf::Uint8>(home_ratio * Conf::TO_HOME_COLOR.b + (1.0f - home_ratio) * Conf::TO_FOOD_COLOR.b);
+				pixel[3] = to<sf::Uint8>(255.0f * std::min(1.0f, total / field_full_intensity));
 			}
 		}
+	}
+
+	void addFoodAt(float x, float y, float quantity)
+	{
+		// The food is linked to the permanent marker of each colony by position, see releaseFoodMarker
+		if (!addMarker(Marker(sf::Vector2f(x, y), Marker::ToFood, 100000000.0f, true, 0))) {
+			return;
+		}
+		for (uint32_t colony(1); colony < getColoniesCount(); ++colony) {
+			addMarker(Marker(sf::Vector2f(x, y), Marker::ToFood, 100000000.0f, true, to<uint16_t>(colony)));
+		}
+		const Food* food = grid_food.add(Food(x, y, 4.0f, quantity));
+		if (food) {
+			food_digest += digest::getHash(*food);
+			food_occupancy.add(grid_food.getCellCoords(food->position));
+		}
+	}
 
-		for (const std::list<Marker>& l : grid_markers_food.cells) {
-			for (const Marker& m : l) {
-				if (!m.permanent) {
-					m.render_in(va, 4 * (current_index++));
+	// Digests computed from the grids, the kept ones have to be equal to them
+	uint64_t computeMarkersDigest() const
+	{
+		uint64_t result = 0;
+		for (const Grid<Marker>& grid : marker_grids) {
+			grid.forEachCell([&](uint64_t, const std::vector<Marker>& cell) {
+				for (const Marker& m : cell) {
+					result += digest::getHash(m);
 				}
+			});
+		}
+		return result;
+	}
+
+	uint64_t computeFoodDigest() const
+	{
+		uint64_t result = 0;
+		grid_food.forEachCell([&](uint64_t, const std::vector<Food>& cell) {
+			for (const Food& f : cell) {
+				result += digest::getHash(f);
 			}
+		});
+		return result;
+	}
+
+	// Conf::MAX_MARKERS_PER_CELL is the limit of a reference_cell_size cell, finer cells hold
+	// proportionally less so that the density of markers is bounded the same way
+	static uint32_t getMaxMarkersPerCell(uint32_t marker_cell_size)
+	{
+		const uint64_t area = to<uint64_t>(marker_cell_size) * marker_cell_size;
+		return std::max(1u, to<uint32_t>(Conf::MAX_MARKERS_PER_CELL * area / (reference_cell_size * reference_cell_size)));
+	}
+
+	uint32_t getColoniesCount() const
+	{
+		return to<uint32_t>(marker_grids.size() / 2);
+	}
+
+	static uint32_t getChannel(uint32_t colony, Marker::Type type)
+	{
+		return 2 * colony + (type == Marker::ToFood ? 1 : 0);
+	}
+
+	Grid<Marker>& getGrid(uint32_t colony, Marker::Type type)
+	{
+		return marker_grids[getChannel(colony, type)];
+	}
+
+	// Starts keeping a marker raster for the sensors of the ants, with the texels of the field if
+	// any. Can be called at any time, the raster is built from the grids
+	void useMarkerRaster(uint32_t texel_size = default_field_texel_size)
+	{
+		if (marker_raster) {
+			return;
 		}
+		const uint32_t raster_texel_size = field ? field->texel_size : texel_size;
+		marker_raster.reset(new MarkerRaster(to<uint32_t>(size.x), to<uint32_t>(size.y), raster_texel_size, to<uint32_t>(marker_grids.size())));
+		rebuildRaster();
 	}
 
-	void addFoodAt(float x, float y, float quantity)
+	void rebuildRaster()
 	{
-		Marker* marker = addMarker(Marker(sf::Vector2f(x, y), Marker::ToFood, 100000000.0f, true));
-		if (marker) {
-			grid_food.add(Food(x, y, 4.0f, quantity, marker));
+		if (!marker_raster) {
+			return;
+		}
+		marker_raster->clear();
+		marker_raster->setDecay(decay_per_tick);
+		for (const Grid<Marker>& grid : marker_grids) {
+			grid.forEachCell([this](uint64_t, const std::vector<Marker>& cell) {
+				for (const Marker& m : cell) {
+					addToRaster(m);
+				}
+			});
 		}
 	}
 
-	Grid<Marker>& getGrid(Marker::Type type)
+	void addToRaster(const Marker& marker)
 	{
-		if (type == Marker::ToFood) {
-			return grid_markers_food;
+		if (marker_raster) {
+			marker_raster->add(getChannel(marker.colony, marker.type), marker);
 		}
-		return grid_markers_home;
+	}
+
+	void removeFromRaster(const Marker& marker)
+	{
+		if (marker_raster) {
+			marker_raster->remove(getChannel(marker.colony, marker.type), marker);
+		}
+	}
+
+	// Intensity read by an ant sensor at position: the marker raster plus the pheromone field,
+	// needs useMarkerRaster
+	float sampleMarkers(uint32_t channel, const sf::Vector2f& position) const
+	{
+		const float markers = marker_raster->get(channel, position, tick);
+		return field ? markers + field->getAt(channel, position) : markers;
+	}
+
+	// Switches fading markers to a pheromone field with texels of texel_size pixels, has to be
+	// called before the first marker is laid
+	void useField(uint32_t texel_size)
+	{
+		field.reset(new PheromoneField(to<uint32_t>(size.x), to<uint32_t>(size.y), texel_size, to<uint32_t>(marker_grids.size())));
 	}
 
 	sf::Vector2f size;
-	mutable sf::VertexArray va;
-	Grid<Marker> grid_markers_home;
-	Grid<Marker> grid_markers_food;
+	mutable MarkerVertexStore marker_vertices;
+	mutable MarkerVerticesUpdate marker_update;
+	mutable MarkerVertexBuffer marker_buffer;
+	mutable std::vector<sf::Vertex> food_vertices;
+	// Indexed by getChannel
+	std::vector<Grid<Marker>> marker_grids;
 	Grid<Food> grid_food;
+	// Kept up to date with every food added to or removed from grid_food
+	FoodOccupancy food_occupancy;
 
+	// Stored markers that are not permanent
 	uint64_t markers_count;
+	uint32_t tick;
+	float decay_per_tick;
+	// Intensity lost per tick at the default 60Hz time step, until the first update gives the actual one
+	static constexpr float default_decay_per_tick = 0.016f;
+	// Fine enough for the stencil of the detection radius to hug its half disc
+	static constexpr uint32_t default_marker_cell_size = 15;
+	static constexpr uint64_t reference_cell_size = 45;
+	static constexpr uint32_t food_cell_size = 5;
+
+	TimingWheel<MarkerCell> marker_expiries;
+	TimingWheel<uint64_t> food_expiries;
+	// Expirations processed by the last update
+	uint64_t expired_markers;
+	uint64_t expired_food;
+	// Kept up to date with every change of the grids, see digest.hpp
+	uint64_t markers_digest;
+	uint64_t food_digest;
+
+	// Deposits closer than coalesce_radius to a marker of their cell are merged into it, 0 never merges
+	float coalesce_radius;
+	float coalesce_max_intensity;
+	// Intensity of a deposit with a full reserve and the default ant parameters
+	static constexpr float default_coalesce_max_intensity = 40.0f;
+	// Deposits merged since the world was created
+	uint64_t coalesced_markers;
+
+	// Null with discrete markers, see useField
+	std::unique_ptr<PheromoneField> field;
+	static constexpr uint32_t default_field_texel_size = 4;
+	// Total intensity of a texel drawn fully opaque
+	static constexpr float field_full_intensity = 20.0f;
+	mutable std::vector<sf::Uint8> field_pixels;
+	mutable sf::Texture field_texture;
+	// Null until an ant steers with sensors, see useMarkerRaster
+	std::unique_ptr<MarkerRaster> marker_raster;
 };
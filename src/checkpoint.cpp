@@ -0,0 +1,533 @@
+#include "checkpoint.hpp"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define ANTSIM_MMAP
+#endif
+
+
+namespace checkpoint
+{
+
+static_assert(sizeof(Header) == 56, "Header layout is part of the file format");
+static_assert(sizeof(ColonyHeader) == 112, "ColonyHeader layout is part of the file format");
+static_assert(sizeof(CellRecord) == 16, "CellRecord layout is part of the file format");
+// Objects are copied from the file as they are, see MarkerRecord
+static_assert(sizeof(MarkerRecord) == sizeof(Marker) && std::is_trivially_copyable<MarkerRecord>::value, "Marker records are whole markers");
+static_assert(std::is_trivially_copyable<Marker>::value && std::is_standard_layout<Marker>::value, "Markers are copied from the file");
+static_assert(std::is_trivially_copyable<Food>::value && std::is_standard_layout<Food>::value, "Food is copied from the file");
+static_assert(sizeof(Marker) == 28 && offsetof(Marker, type) == 8 && offsetof(Marker, intensity) == 12 && offsetof(Marker, permanent) == 16
+	&& offsetof(Marker, colony) == 18 && offsetof(Marker, deposit_tick) == 20 && sizeof(Marker::Type) == 4, "Marker layout is part of the file format");
+static_assert(sizeof(Food) == 16 && offsetof(Food, radius) == 8 && offsetof(Food, quantity) == 12, "Food layout is part of the file format");
+
+namespace
+{
+
+bool isLittleEndian()
+{
+	const uint32_t one = 1;
+	uint8_t first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+// Sections start on 8 bytes boundaries, columns on 4 bytes ones
+uint64_t getPaddedSize(uint64_t size, uint64_t alignment = 4)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Bytes of the ants section
+uint64_t getAntsSize(uint64_t ants_count)
+{
+	return 12 * 4 * ants_count + getPaddedSize(ants_count, 8);
+}
+
+template<typename T>
+void writeColumn(std::ostream& out, const std::vector<T>& column)
+{
+	out.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+}
+
+// Non empty cells of grid by increasing index, so that files do not depend on the chunks layout in memory
+template<typename T>
+std::vector<std::pair<uint64_t, const std::vector<T>*>> getSortedCells(const Grid<T>& grid)
+{
+	std::vector<std::pair<uint64_t, const std::vector<T>*>> cells;
+	grid.forEachCell([&](uint64_t cell_index, const std::vector<T>& cell) {
+		cells.emplace_back(cell_index, &cell);
+	});
+	std::sort(cells.begin(), cells.end(), [](const std::pair<uint64_t, const std::vector<T>*>& a, const std::pair<uint64_t, const std::vector<T>*>& b) {
+		return a.first < b.first;
+	});
+	return cells;
+}
+
+template<typename T>
+void writeCells(std::ostream& out, const std::vector<std::pair<uint64_t, const std::vector<T>*>>& cells)
+{
+	uint64_t objects_count = 0;
+	for (const auto& cell : cells) {
+		const CellRecord record{cell.first, to<uint32_t>(cell.second->size()), 0};
+		out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		objects_count += cell.second->size();
+	}
+
+	std::vector<decltype(toRecord(std::declval<const T&>()))> records;
+	for (const auto& cell : cells) {
+		records.clear();
+		for (const T& obj : *cell.second) {
+			records.push_back(toRecord(obj));
+		}
+		writeColumn(out, records);
+	}
+	const uint64_t zero = 0;
+	out.write(reinterpret_cast<const char*>(&zero), getPaddedSize(objects_count * sizeof(T), 8) - objects_count * sizeof(T));
+}
+
+// Copies the objects of the cells section at data, checked by Reader::open, in grid and moves data after it
+template<typename T>
+bool readCells(const uint8_t*& data, uint64_t cells_count, uint64_t objects_count, Grid<T>& grid)
+{
+	const CellRecord* cells = reinterpret_cast<const CellRecord*>(data);
+	const T* objects = reinterpret_cast<const T*>(cells + cells_count);
+	for (uint64_t i(0); i < cells_count; ++i) {
+		if (!grid.assign(grid.getCoordsFromIndex(cells[i].index), objects, cells[i].count)) {
+			return false;
+		}
+		objects += cells[i].count;
+	}
+	data = reinterpret_cast<const uint8_t*>(cells + cells_count) + getPaddedSize(objects_count * sizeof(T), 8);
+	return true;
+}
+
+// Worlds are at most max_world_side pixels wide and high, far more than any run needs but small
+// enough for the cell indexes and the grid sizes to fit in their types
+constexpr uint32_t max_world_side = 1u << 20;
+
+// Checks that the world of header can be built: whole sizes in pixels and cells of the size World
+// gives them, at most as large as the world. Grids divide by the cell sizes
+bool checkWorld(const Header& header)
+{
+	const float width = header.world_width;
+	const float height = header.world_height;
+	if (!(width >= 1.0f && width <= to<float>(max_world_side) && height >= 1.0f && height <= to<float>(max_world_side))
+		|| width != std::floor(width) || height != std::floor(height)) {
+		return false;
+	}
+	const uint32_t min_side = std::min(to<uint32_t>(width), to<uint32_t>(height));
+	// Expiry ticks are computed from the decay, a null or NaN one never expires anything
+	const bool valid_decay = std::isfinite(header.decay_per_tick) && header.decay_per_tick > 0.0f;
+	return header.marker_cell_size && header.marker_cell_size <= min_side
+		&& header.food_cell_size == World::food_cell_size && header.food_cell_size <= min_side && valid_decay;
+}
+
+// Cells of one of the grids of a world, as Grid computes them
+struct GridShape
+{
+	GridShape(const Header& header, uint32_t cell_size_)
+		: cell_size(cell_size_)
+		, width(to<uint32_t>(header.world_width) / cell_size_)
+		, height(to<uint32_t>(header.world_height) / cell_size_)
+	{}
+
+	// Same computation as Grid::getCellCoords, position has to be in the grid
+	uint64_t getIndex(const sf::Vector2f& position) const
+	{
+		const float size = to<float>(cell_size);
+		if (!(position.x >= 0.0f && position.y >= 0.0f && position.x < size * to<float>(width) && position.y < size * to<float>(height))) {
+			return ~uint64_t(0);
+		}
+		return to<uint64_t>(to<int32_t>(position.x / size)) + to<uint64_t>(to<int32_t>(position.y / size)) * width;
+	}
+
+	uint32_t cell_size;
+	uint32_t width, height;
+};
+
+// Checks that the cells section at data fits before end, that its cells are non empty, sorted and
+// hold objects_count objects which are all in their cell and pass check, then moves data after it.
+// Objects are then copied as they are by restore, they cannot hold anything World could not
+template<typename T, typename Check>
+bool checkCells(const uint8_t*& data, const uint8_t* end, uint64_t cells_count, uint64_t objects_count, const GridShape& shape, Check&& check)
+{
+	if (cells_count > to<uint64_t>(end - data) / sizeof(CellRecord)) {
+		return false;
+	}
+	const CellRecord* cells = reinterpret_cast<const CellRecord*>(data);
+	uint64_t count = 0;
+	for (uint64_t i(0); i < cells_count; ++i) {
+		count += cells[i].count;
+	}
+	data += cells_count * sizeof(CellRecord);
+	if (count != objects_count || objects_count > to<uint64_t>(end - data) / sizeof(T)
+		|| getPaddedSize(objects_count * sizeof(T), 8) > to<uint64_t>(end - data)) {
+		return false;
+	}
+
+	const T* object = reinterpret_cast<const T*>(data);
+	for (uint64_t i(0); i < cells_count; ++i) {
+		if (!cells[i].count || (i && cells[i].index <= cells[i - 1].index)) {
+			return false;
+		}
+		for (uint32_t k(0); k < cells[i].count; ++k, ++object) {
+			if (shape.getIndex(object->position) != cells[i].index || !check(*object)) {
+				return false;
+			}
+		}
+	}
+	data += getPaddedSize(objects_count * sizeof(T), 8);
+	return true;
+}
+
+// Markers of a colony section have the type and colony of their grid, read from the bytes since
+// the file could hold values that are not valid for the enum and the bool. Their intensity has
+// to be finite and positive, and fading ones have to expire within Marker::max_age ticks
+bool checkMarker(const Marker& marker, Marker::Type type, uint32_t colony, float decay_per_tick)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&marker);
+	uint32_t marker_type;
+	std::memcpy(&marker_type, bytes + offsetof(Marker, type), sizeof(marker_type));
+	if (marker_type != to<uint32_t>(type) || bytes[offsetof(Marker, permanent)] > 1 || marker.colony != colony) {
+		return false;
+	}
+	const bool permanent = bytes[offsetof(Marker, permanent)] == 1;
+	return std::isfinite(marker.intensity) && marker.intensity >= 0.0f
+		&& (permanent || marker.intensity / decay_per_tick < static_cast<float>(Marker::max_age));
+}
+
+// Reads the column of count T at data and moves data after it
+template<typename T>
+void readColumn(const uint8_t*& data, uint64_t count, std::vector<T>& column, uint64_t alignment = 4)
+{
+	const T* begin = reinterpret_cast<const T*>(data);
+	column.assign(begin, begin + count);
+	data += getPaddedSize(count * sizeof(T), alignment);
+}
+
+}
+
+
+MarkerRecord toRecord(const Marker& m)
+{
+	// Fields are copied one by one over zeroed bytes, files do not depend on memory content
+	MarkerRecord record{};
+	const uint8_t permanent = m.permanent ? 1 : 0;
+	const uint32_t vertex_slot = 0xFFFFFFFF;
+	std::memcpy(record.bytes + offsetof(Marker, position), &m.position, sizeof(m.position));
+	std::memcpy(record.bytes + offsetof(Marker, type), &m.type, sizeof(m.type));
+	std::memcpy(record.bytes + offsetof(Marker, intensity), &m.intensity, sizeof(m.intensity));
+	std::memcpy(record.bytes + offsetof(Marker, permanent), &permanent, sizeof(permanent));
+	std::memcpy(record.bytes + offsetof(Marker, colony), &m.colony, sizeof(m.colony));
+	std::memcpy(record.bytes + offsetof(Marker, deposit_tick), &m.deposit_tick, sizeof(m.deposit_tick));
+	std::memcpy(record.bytes + offsetof(Marker, vertex_slot), &vertex_slot, sizeof(vertex_slot));
+	return record;
+}
+
+FoodRecord toRecord(const Food& f)
+{
+	return f;
+}
+
+Marker fromRecord(const MarkerRecord& record, uint16_t colony)
+{
+	Marker m;
+	std::memcpy(&m, record.bytes, sizeof(m));
+	m.colony = colony;
+	return m;
+}
+
+Food fromRecord(const FoodRecord& record, uint16_t)
+{
+	return record;
+}
+
+
+bool save(const std::string& path, const World& world, const std::vector<Colony>& colonies)
+{
+	// Only discrete markers are stored, not the pheromone field
+	if (!isLittleEndian() || colonies.size() != world.getColoniesCount() || world.field) {
+		return false;
+	}
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		return false;
+	}
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.header_size = sizeof(Header);
+	header.world_width = world.size.x;
+	header.world_height = world.size.y;
+	header.marker_cell_size = world.marker_grids.front().cell_size;
+	header.food_cell_size = world.grid_food.cell_size;
+	header.world_tick = world.tick;
+	header.decay_per_tick = world.decay_per_tick;
+	header.colonies_count = to<uint32_t>(colonies.size());
+
+	const auto food_cells = getSortedCells(world.grid_food);
+	header.food_cells_count = to<uint32_t>(food_cells.size());
+	header.food_count = world.grid_food.getObjectsCount();
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// Cells of every colony, the sections are written after all the colony headers
+	std::vector<std::vector<std::pair<uint64_t, const std::vector<Marker>*>>> home_cells, food_marker_cells;
+	for (const Colony& colony : colonies) {
+		const Grid<Marker>& home_grid = world.marker_grids[World::getChannel(colony.id, Marker::ToHome)];
+		const Grid<Marker>& food_grid = world.marker_grids[World::getChannel(colony.id, Marker::ToFood)];
+		home_cells.push_back(getSortedCells(home_grid));
+		food_marker_cells.push_back(getSortedCells(food_grid));
+
+		const AntParameters& parameters = colony.ants.parameters;
+		ColonyHeader colony_header;
+		std::memset(&colony_header, 0, sizeof(colony_header));
+		colony_header.seed = colony.rng.seed;
+		colony_header.colony_x = colony.position.x;
+		colony_header.colony_y = colony.position.y;
+		colony_header.colony_tick = colony.tick;
+		colony_header.ants_count = to<uint32_t>(colony.ants.size());
+		colony_header.id = colony.id;
+		colony_header.direction_mode = to<uint32_t>(parameters.direction_mode);
+		colony_header.ant_width = parameters.width;
+		colony_header.ant_length = parameters.length;
+		colony_header.move_speed = parameters.move_speed;
+		colony_header.marker_detection_max_dist = parameters.marker_detection_max_dist;
+		colony_header.direction_update_period = parameters.direction_update_period;
+		colony_header.marker_period = parameters.marker_period;
+		colony_header.max_reserve = parameters.max_reserve;
+		colony_header.direction_noise_range = parameters.direction_noise_range;
+		colony_header.marker_reserve_consumption = parameters.marker_reserve_consumption;
+		colony_header.colony_size = parameters.colony_size;
+		colony_header.rotation_speed = parameters.rotation_speed;
+		colony_header.steering = to<uint32_t>(parameters.steering);
+		colony_header.sensor_angle = parameters.sensor_angle;
+		colony_header.sensor_distance = parameters.sensor_distance;
+		colony_header.home_marker_cells_count = to<uint32_t>(home_cells.back().size());
+		colony_header.food_marker_cells_count = to<uint32_t>(food_marker_cells.back().size());
+		colony_header.home_markers_count = home_grid.getObjectsCount();
+		colony_header.food_markers_count = food_grid.getObjectsCount();
+		out.write(reinterpret_cast<const char*>(&colony_header), sizeof(colony_header));
+	}
+
+	for (uint32_t c(0); c < colonies.size(); ++c) {
+		const Ants& ants = colonies[c].ants;
+		for (const std::vector<float>* column : {&ants.position_x, &ants.position_y, &ants.last_direction_update, &ants.last_marker, &ants.reserve,
+			&ants.direction.angle, &ants.direction.target_angle, &ants.direction.vec_x, &ants.direction.vec_y, &ants.direction.target_x, &ants.direction.target_y}) {
+			writeColumn(out, *column);
+		}
+		writeColumn(out, ants.id);
+		writeColumn(out, ants.phase);
+		const uint64_t zero = 0;
+		out.write(reinterpret_cast<const char*>(&zero), getPaddedSize(ants.size(), 8) - ants.size());
+
+		writeCells(out, home_cells[c]);
+		writeCells(out, food_marker_cells[c]);
+	}
+	writeCells(out, food_cells);
+
+	return static_cast<bool>(out);
+}
+
+
+Reader::Reader()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_mapping(nullptr)
+{}
+
+Reader::~Reader()
+{
+#ifdef ANTSIM_MMAP
+	if (m_mapping) {
+		munmap(m_mapping, m_size);
+	}
+#endif
+}
+
+bool Reader::open(const std::string& path)
+{
+	if (!isLittleEndian()) {
+		return false;
+	}
+
+#ifdef ANTSIM_MMAP
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void* mapping = mmap(nullptr, to<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			m_mapping = mapping;
+			m_data = static_cast<const uint8_t*>(mapping);
+			m_size = to<uint64_t>(info.st_size);
+		}
+	}
+	::close(fd);
+#endif
+
+	if (!m_data) {
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		if (!in) {
+			return false;
+		}
+		m_buffer.resize(to<uint64_t>(in.tellg()));
+		in.seekg(0);
+		in.read(reinterpret_cast<char*>(m_buffer.data()), m_buffer.size());
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+	}
+
+	if (m_size < sizeof(Header)) {
+		return false;
+	}
+
+	const Header& header = getHeader();
+	if (std::memcmp(header.magic, magic, sizeof(magic)) || header.version != version || header.header_size != sizeof(Header) || !checkWorld(header)) {
+		return false;
+	}
+
+	// Marker::colony holds colony ids
+	const uint64_t headers_size = sizeof(Header) + sizeof(ColonyHeader) * to<uint64_t>(header.colonies_count);
+	if (!header.colonies_count || header.colonies_count > 0x10000 || m_size < headers_size) {
+		return false;
+	}
+	// Every colony has its own marker channels
+	std::vector<bool> used_ids(header.colonies_count, false);
+	for (uint32_t i(0); i < header.colonies_count; ++i) {
+		const uint32_t id = getColonyHeader(i).id;
+		if (id >= header.colonies_count || used_ids[id]) {
+			return false;
+		}
+		used_ids[id] = true;
+	}
+
+	// Every section has to fit in the file and the cells to hold the objects counted by the
+	// headers, so that restore never reads past the end
+	const uint8_t* data = m_data + headers_size;
+	const uint8_t* end = m_data + m_size;
+	const GridShape marker_shape(header, header.marker_cell_size);
+	for (uint32_t i(0); i < header.colonies_count; ++i) {
+		const ColonyHeader& colony_header = getColonyHeader(i);
+		const uint64_t ants_size = getAntsSize(colony_header.ants_count);
+		if (colony_header.direction_mode > Directions::Vector || colony_header.steering > AntParameters::Sensors || ants_size > to<uint64_t>(end - data)) {
+			return false;
+		}
+		data += ants_size;
+		const uint32_t id = colony_header.id;
+		const float decay = header.decay_per_tick;
+		if (!checkCells<Marker>(data, end, colony_header.home_marker_cells_count, colony_header.home_markers_count, marker_shape,
+				[id, decay](const Marker& m) { return checkMarker(m, Marker::ToHome, id, decay); })
+			|| !checkCells<Marker>(data, end, colony_header.food_marker_cells_count, colony_header.food_markers_count, marker_shape,
+				[id, decay](const Marker& m) { return checkMarker(m, Marker::ToFood, id, decay); })) {
+			return false;
+		}
+	}
+	const GridShape food_shape(header, header.food_cell_size);
+	return checkCells<Food>(data, end, header.food_cells_count, header.food_count, food_shape, [](const Food&) { return true; }) && data == end;
+}
+
+AntParameters Reader::getAntParameters(uint32_t colony) const
+{
+	const ColonyHeader& header = getColonyHeader(colony);
+	AntParameters parameters;
+	parameters.width = header.ant_width;
+	parameters.length = header.ant_length;
+	parameters.move_speed = header.move_speed;
+	parameters.marker_detection_max_dist = header.marker_detection_max_dist;
+	parameters.direction_update_period = header.direction_update_period;
+	parameters.marker_period = header.marker_period;
+	parameters.max_reserve = header.max_reserve;
+	parameters.direction_noise_range = header.direction_noise_range;
+	parameters.marker_reserve_consumption = header.marker_reserve_consumption;
+	parameters.colony_size = header.colony_size;
+	parameters.rotation_speed = header.rotation_speed;
+	parameters.direction_mode = static_cast<Directions::Mode>(header.direction_mode);
+	parameters.steering = static_cast<AntParameters::Steering>(header.steering);
+	parameters.sensor_angle = header.sensor_angle;
+	parameters.sensor_distance = header.sensor_distance;
+	return parameters;
+}
+
+std::vector<Colony> Reader::makeColonies() const
+{
+	std::vector<Colony> colonies;
+	colonies.reserve(getHeader().colonies_count);
+	for (uint32_t i(0); i < getHeader().colonies_count; ++i) {
+		const ColonyHeader& header = getColonyHeader(i);
+		colonies.emplace_back(header.colony_x, header.colony_y, 0, header.seed, getAntParameters(i), to<uint16_t>(header.id));
+	}
+	return colonies;
+}
+
+bool Reader::restore(World& world, std::vector<Colony>& colonies) const
+{
+	const Header& header = getHeader();
+	if (world.size != sf::Vector2f(header.world_width, header.world_height)
+		|| to<uint32_t>(world.marker_grids.front().cell_size) != header.marker_cell_size
+		|| to<uint32_t>(world.grid_food.cell_size) != header.food_cell_size
+		|| world.getColoniesCount() != header.colonies_count
+		|| colonies.size() != header.colonies_count) {
+		return false;
+	}
+	for (uint32_t i(0); i < header.colonies_count; ++i) {
+		const ColonyHeader& colony_header = getColonyHeader(i);
+		if (colony_header.id >= header.colonies_count || colonies[i].rng.seed != colony_header.seed || colonies[i].id != colony_header.id) {
+			return false;
+		}
+	}
+
+	for (Grid<Marker>& grid : world.marker_grids) {
+		grid.clear();
+	}
+	world.grid_food.clear();
+
+	const uint8_t* data = m_data + sizeof(Header) + sizeof(ColonyHeader) * to<uint64_t>(header.colonies_count);
+	for (uint32_t i(0); i < header.colonies_count; ++i) {
+		const ColonyHeader& colony_header = getColonyHeader(i);
+		Colony& colony = colonies[i];
+		const uint64_t ants_count = colony_header.ants_count;
+		Ants& ants = colony.ants;
+		for (std::vector<float>* column : {&ants.position_x, &ants.position_y, &ants.last_direction_update, &ants.last_marker, &ants.reserve,
+			&ants.direction.angle, &ants.direction.target_angle, &ants.direction.vec_x, &ants.direction.vec_y, &ants.direction.target_x, &ants.direction.target_y}) {
+			readColumn(data, ants_count, *column);
+		}
+		readColumn(data, ants_count, ants.id);
+		readColumn(data, ants_count, ants.phase, 8);
+		colony.tick = colony_header.colony_tick;
+		colony.resizeChunks();
+
+		if (!readCells(data, colony_header.home_marker_cells_count, colony_header.home_markers_count, world.getGrid(colony.id, Marker::ToHome))
+			|| !readCells(data, colony_header.food_marker_cells_count, colony_header.food_markers_count, world.getGrid(colony.id, Marker::ToFood))) {
+			return false;
+		}
+	}
+	if (!readCells(data, header.food_cells_count, header.food_count, world.grid_food)) {
+		return false;
+	}
+
+	world.tick = header.world_tick;
+	world.decay_per_tick = header.decay_per_tick;
+	world.rebuildIndexes();
+	for (const Colony& colony : colonies) {
+		if (colony.ants.parameters.steering == AntParameters::Sensors) {
+			world.useMarkerRaster();
+		}
+	}
+	return true;
+}
+
+}
@@ -11,3 +11,4 @@ const uint32_t Conf::WIN_WIDTH = 1920;
 const uint32_t Conf::WIN_HEIGHT = 1080;
 std::shared_ptr<sf::Texture> Conf::ANT_TEXTURE;
 std::shared_ptr<sf::Texture> Conf::MARKER_TEXTURE;
+std::shared_ptr<sf::Texture> Conf::CIRCLE_TEXTURE;
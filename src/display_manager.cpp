@@ -1,7 +1,11 @@
 #include "display_manager.hpp"
+#include "colony.hpp"
+#include <sstream>
+#include <iomanip>
+#include <iostream>
 
 
-DisplayManager::DisplayManager(sf::RenderTarget& target, sf::RenderWindow& window, World& world, Colony& colony)
+DisplayManager::DisplayManager(sf::RenderTarget& target, sf::RenderWindow& window)
 	: m_window(window)
 	, m_target(target)
 	, m_zoom(1.0f)
@@ -11,8 +15,9 @@ DisplayManager::DisplayManager(sf::RenderTarget& target, sf::RenderWindow& windo
 	, m_va(sf::Quads, 0)
 	, update(true)
 	, debug_mode(false)
-	, m_world(world)
-	, m_colony(colony)
+	, save_checkpoint(false)
+	, switch_steering(false)
+	, m_snapshot_version(0)
 	, clic(false)
 	, m_mouse_button_pressed(false)
 	, pause(false)
@@ -25,6 +30,7 @@ DisplayManager::DisplayManager(sf::RenderTarget& target, sf::RenderWindow& windo
 	m_offsetY = m_windowOffsetY;
 
     m_texture.loadFromFile("res/circle.png");
+	m_font_loaded = m_font.loadFromFile("res/font.ttf");
 }
 
 sf::Vector2f DisplayManager::worldCoordToDisplayCoord(const sf::Vector2f& worldCoord)
@@ -49,11 +55,21 @@ sf::Vector2f DisplayManager::displayCoordToWorldCoord(const sf::Vector2f& viewCo
     return sf::Vector2f(worldCoordX, worldCoordY);
 }
 
-void DisplayManager::draw()
+void DisplayManager::draw(const RenderSnapshot& snapshot)
 {
-	sf::Clock clock;
+	if (snapshot.version != m_snapshot_version) {
+		m_markers.apply(snapshot.markers);
+		if (snapshot.field_texel_size) {
+			if (m_field_texture.getSize() != snapshot.field_size) {
+				m_field_texture.create(snapshot.field_size.x, snapshot.field_size.y);
+			}
+			m_field_texture.update(snapshot.field_pixels.data());
+		}
+		m_snapshot_version = snapshot.version;
+	}
+
     // draw the world's ground as a big black square
-    sf::RectangleShape ground(sf::Vector2f(m_world.size.x, m_world.size.y));
+    sf::RectangleShape ground(sf::Vector2f(snapshot.world_size.x, snapshot.world_size.y));
     ground.setFillColor(sf::Color::Black);
 
 	sf::RenderStates rs_ground;
@@ -68,10 +84,86 @@ void DisplayManager::draw()
 	rs.transform.scale(m_zoom, m_zoom);
 	rs.transform.translate(-m_offsetX, -m_offsetY);
 
-	m_world.render(m_target, rs, draw_markers);
-	m_colony.render(m_target, rs);
+	if (draw_markers && snapshot.field_texel_size) {
+		sf::Sprite field(m_field_texture);
+		field.setScale(to<float>(snapshot.field_texel_size), to<float>(snapshot.field_texel_size));
+		m_target.draw(field, rs);
+	}
+	if (draw_markers) {
+		sf::RenderStates rs_markers = rs;
+		rs_markers.texture = &(*Conf::MARKER_TEXTURE);
+		m_markers.draw(m_target, rs_markers);
+	}
+
+	sf::RenderStates rs_food = rs;
+	rs_food.texture = &(*Conf::CIRCLE_TEXTURE);
+	m_target.draw(snapshot.food.data(), snapshot.food.size(), sf::Quads, rs_food);
+
+	Colony::render(m_target, rs, snapshot.ants, snapshot.carried_food, snapshot.colony_positions, snapshot.colony_size);
+}
 
-	render_time = clock.getElapsedTime().asMicroseconds() * 0.001f;
+void DisplayManager::drawProfiler(const Profiler& profiler)
+{
+	const float px_per_ms = 40.0f;
+	const float row_height = 18.0f;
+	const float left = 10.0f;
+	const float bars_left = m_font_loaded ? 420.0f : left;
+	static const sf::Color colors[PhaseTimes::PhasesCount] = {
+		sf::Color(200, 200, 200),
+		sf::Color(255, 73, 68),
+		sf::Color(255, 160, 60),
+		sf::Color(255, 220, 80),
+		sf::Color(120, 210, 110),
+		sf::Color(80, 190, 200),
+		sf::Color(90, 130, 255),
+		sf::Color(170, 100, 230),
+		sf::Color(230, 100, 180),
+		sf::Color(255, 255, 255),
+	};
+
+	std::ostringstream table;
+	sf::RectangleShape background(sf::Vector2f(bars_left + 700.0f, row_height * PhaseTimes::PhasesCount + 10.0f));
+	background.setPosition(0.0f, 0.0f);
+	background.setFillColor(sf::Color(0, 0, 0, 180));
+	m_target.draw(background);
+
+	for (uint32_t i(0); i < PhaseTimes::PhasesCount; ++i) {
+		const PhaseTimes::Phase phase = static_cast<PhaseTimes::Phase>(i);
+		const float y = 5.0f + i * row_height;
+		const float percentiles[3] = {profiler.getPercentile(phase, 0.99f), profiler.getPercentile(phase, 0.95f), profiler.getPercentile(phase, 0.5f)};
+
+		// p99 then p95 then p50 on top, brighter and brighter
+		const sf::Uint8 alphas[3] = {70, 140, 255};
+		for (uint32_t k(0); k < 3; ++k) {
+			sf::Color color = colors[i];
+			color.a = alphas[k];
+			sf::RectangleShape bar(sf::Vector2f(std::min(percentiles[k] * px_per_ms, 700.0f), row_height - 4.0f));
+			bar.setPosition(bars_left, y + 2.0f);
+			bar.setFillColor(color);
+			m_target.draw(bar);
+		}
+
+		std::ostringstream label;
+		label << std::left << std::setw(18) << PhaseTimes::getName(phase) << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(8) << percentiles[2] << std::setw(8) << percentiles[1] << std::setw(8) << percentiles[0] << " ms";
+		if (m_font_loaded) {
+			sf::Text text(label.str(), m_font, 13);
+			text.setPosition(left, y);
+			text.setFillColor(colors[i]);
+			m_target.draw(text);
+		}
+		else {
+			table << label.str() << std::endl;
+		}
+	}
+
+	// Without a font the values go to the console, once per second so that they can be read
+	const auto now = std::chrono::steady_clock::now();
+	if (!m_font_loaded && now - m_last_profiler_print >= std::chrono::seconds(1)) {
+		std::cout << std::left << std::setw(18) << "phase" << std::right << std::setw(8) << "p50" << std::setw(8) << "p95" << std::setw(8) << "p99" << std::endl;
+		std::cout << table.str() << std::endl;
+		m_last_profiler_print = now;
+	}
 }
 
 
@@ -95,6 +187,8 @@ void DisplayManager::processEvents()
 			else if ((event.key.code == sf::Keyboard::E)) pause = !pause;
 			else if ((event.key.code == sf::Keyboard::A)) draw_markers = !draw_markers;
 			else if ((event.key.code == sf::Keyboard::D)) debug_mode = !debug_mode;
+			else if ((event.key.code == sf::Keyboard::F5)) save_checkpoint = true;
+			else if ((event.key.code == sf::Keyboard::T)) switch_steering = true;
 			else if ((event.key.code == sf::Keyboard::R))
 			{
 				m_offsetX = 0.0f;
@@ -104,7 +198,6 @@ void DisplayManager::processEvents()
 			else if ((event.key.code == sf::Keyboard::S))
 			{
 				speed_mode = !speed_mode;
-				m_window.setFramerateLimit(speed_mode ? 0 : 60);
 			}
 			break;
 		case sf::Event::MouseWheelMoved:
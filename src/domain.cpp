@@ -0,0 +1,769 @@
+#include "domain.hpp"
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include "checkpoint.hpp"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define ANTSIM_FORK
+#endif
+
+
+namespace domain
+{
+
+uint32_t getGhostColumns(const World& world, const std::vector<Colony>& colonies)
+{
+	// Food is looked for in the 3x3 food cells around the ant
+	float reach = 2.0f * to<float>(world.grid_food.cell_size);
+	for (const Colony& colony : colonies) {
+		reach = std::max(reach, colony.ants.parameters.marker_detection_max_dist);
+		// Sensors read the whole texel under them
+		if (colony.ants.parameters.steering == AntParameters::Sensors && world.marker_raster) {
+			reach = std::max(reach, colony.ants.parameters.sensor_distance + to<float>(world.marker_raster->texel_size) * 1.5f);
+		}
+	}
+	return 1 + to<uint32_t>(std::ceil(reach / to<float>(world.marker_grids.front().cell_size)));
+}
+
+Strips::Strips(const World& world, uint32_t strips_count, uint32_t ghost_columns_)
+	: column_width(to<float>(world.marker_grids.front().cell_size))
+	, columns_count(to<uint32_t>(world.size.x / column_width) + 1)
+	, ghost_columns(ghost_columns_)
+{
+	for (uint32_t i(0); i <= strips_count; ++i) {
+		first_columns.push_back(to<uint32_t>(to<uint64_t>(columns_count) * i / strips_count));
+	}
+}
+
+uint32_t Strips::getColumn(float x) const
+{
+	// Same computation as Grid::getCellCoords so that columns match the marker cells
+	const int32_t column = to<int32_t>(x / column_width);
+	return to<uint32_t>(std::min(std::max(column, 0), to<int32_t>(columns_count) - 1));
+}
+
+uint32_t Strips::getOwner(uint32_t column) const
+{
+	return to<uint32_t>(std::upper_bound(first_columns.begin(), first_columns.end(), column) - first_columns.begin()) - 1;
+}
+
+bool Strips::holds(uint32_t strip, uint32_t column) const
+{
+	const uint32_t first = first_columns[strip];
+	const uint32_t width = first_columns[strip + 1] - first;
+	const uint32_t offset = (column + ghost_columns + columns_count - first) % columns_count;
+	return offset < width + 2 * ghost_columns;
+}
+
+std::vector<uint32_t> Strips::getNeighbours(uint32_t strip) const
+{
+	const uint32_t n = count();
+	std::vector<uint32_t> neighbours;
+	if (n > 1) {
+		neighbours.push_back((strip + n - 1) % n);
+	}
+	if (n > 2) {
+		neighbours.push_back((strip + 1) % n);
+	}
+	return neighbours;
+}
+
+#ifdef ANTSIM_FORK
+
+namespace
+{
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Rings rely on lock free atomics to be shared between processes");
+
+// Single producer single consumer byte queue living in memory shared by two processes.
+// Counters only grow, the data is at their value modulo the capacity
+struct Ring
+{
+	explicit Ring(uint64_t capacity_)
+		: written(0)
+		, read(0)
+		, capacity(capacity_)
+	{}
+
+	// Returns the number of bytes actually pushed, limited by the free space
+	uint64_t push(const uint8_t* bytes, uint64_t size)
+	{
+		const uint64_t w = written.load(std::memory_order_relaxed);
+		const uint64_t count = std::min(size, capacity - (w - read.load(std::memory_order_acquire)));
+		for (uint64_t done(0); done < count;) {
+			const uint64_t offset = (w + done) % capacity;
+			const uint64_t part = std::min(count - done, capacity - offset);
+			std::memcpy(getData() + offset, bytes + done, part);
+			done += part;
+		}
+		written.store(w + count, std::memory_order_release);
+		return count;
+	}
+
+	// Returns the number of bytes actually popped, limited by the available ones
+	uint64_t pop(uint8_t* bytes, uint64_t size)
+	{
+		const uint64_t r = read.load(std::memory_order_relaxed);
+		const uint64_t count = std::min(size, written.load(std::memory_order_acquire) - r);
+		for (uint64_t done(0); done < count;) {
+			const uint64_t offset = (r + done) % capacity;
+			const uint64_t part = std::min(count - done, capacity - offset);
+			std::memcpy(bytes + done, getData() + offset, part);
+			done += part;
+		}
+		read.store(r + count, std::memory_order_release);
+		return count;
+	}
+
+	uint8_t* getData()
+	{
+		return reinterpret_cast<uint8_t*>(this + 1);
+	}
+
+	// Each counter is only written by one side, they are kept on their own cache line
+	alignas(64) std::atomic<uint64_t> written;
+	alignas(64) std::atomic<uint64_t> read;
+	alignas(64) const uint64_t capacity;
+};
+
+// Rings of both directions between two processes, null when nothing goes that way
+struct Link
+{
+	Ring* out;
+	Ring* in;
+};
+
+// Sends messages[i] through links[i].out and receives one message from every links[i].in
+// into received[i]. All the links progress together so that two workers sending each other
+// messages larger than the rings cannot block. idle is called whenever nothing moved, the
+// exchange stops if it returns false
+template<typename Idle>
+bool exchange(const std::vector<Link>& links, const std::vector<std::vector<uint8_t>>& messages, std::vector<std::vector<uint8_t>>& received, Idle&& idle)
+{
+	// Messages are prefixed with their size
+	constexpr uint64_t prefix = sizeof(uint64_t);
+	const uint64_t links_count = links.size();
+	std::vector<uint64_t> sent(links_count, 0);
+	std::vector<uint64_t> got(links_count, 0);
+	std::vector<uint64_t> sizes(links_count, 0);
+	received.resize(links_count);
+
+	while (true) {
+		bool pending = false;
+		bool progress = false;
+		for (uint64_t i(0); i < links_count; ++i) {
+			if (links[i].out) {
+				const uint64_t size = messages[i].size();
+				uint64_t count = 0;
+				if (sent[i] < prefix) {
+					count = links[i].out->push(reinterpret_cast<const uint8_t*>(&size) + sent[i], prefix - sent[i]);
+				}
+				else if (sent[i] < prefix + size) {
+					count = links[i].out->push(messages[i].data() + sent[i] - prefix, prefix + size - sent[i]);
+				}
+				sent[i] += count;
+				progress |= count > 0;
+				pending |= sent[i] < prefix + size;
+			}
+
+			if (links[i].in) {
+				uint64_t count = 0;
+				if (got[i] < prefix) {
+					count = links[i].in->pop(reinterpret_cast<uint8_t*>(&sizes[i]) + got[i], prefix - got[i]);
+					if (got[i] + count == prefix) {
+						received[i].resize(sizes[i]);
+					}
+				}
+				else if (got[i] < prefix + sizes[i]) {
+					count = links[i].in->pop(received[i].data() + got[i] - prefix, prefix + sizes[i] - got[i]);
+				}
+				got[i] += count;
+				progress |= count > 0;
+				pending |= got[i] < prefix || got[i] < prefix + sizes[i];
+			}
+		}
+
+		if (!pending) {
+			return true;
+		}
+		if (!progress && !idle()) {
+			return false;
+		}
+	}
+}
+
+struct ByteWriter
+{
+	explicit ByteWriter(std::vector<uint8_t>& bytes_)
+		: bytes(bytes_)
+	{
+		bytes.clear();
+	}
+
+	template<typename T>
+	void write(const T& value)
+	{
+		const uint8_t* begin = reinterpret_cast<const uint8_t*>(&value);
+		bytes.insert(bytes.end(), begin, begin + sizeof(T));
+	}
+
+	// Count then values
+	template<typename T>
+	void writeArray(const std::vector<T>& values)
+	{
+		write(to<uint64_t>(values.size()));
+		const uint8_t* begin = reinterpret_cast<const uint8_t*>(values.data());
+		bytes.insert(bytes.end(), begin, begin + values.size() * sizeof(T));
+	}
+
+	std::vector<uint8_t>& bytes;
+};
+
+struct ByteReader
+{
+	explicit ByteReader(const std::vector<uint8_t>& bytes)
+		: data(bytes.data())
+	{}
+
+	template<typename T>
+	T read()
+	{
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return value;
+	}
+
+	template<typename T>
+	void readArray(std::vector<T>& values)
+	{
+		values.resize(read<uint64_t>());
+		if (!values.empty()) {
+			std::memcpy(values.data(), data, values.size() * sizeof(T));
+			data += values.size() * sizeof(T);
+		}
+	}
+
+	const uint8_t* data;
+};
+
+// A change made by an ant, with what is needed to apply it in any process holding its cell
+struct ChangeRecord
+{
+	enum Kind : uint32_t {
+		PickFood,
+		AddMarker
+	};
+
+	uint32_t colony;
+	uint32_t ant;
+	uint32_t kind;
+	uint32_t marker_type;
+	// Position of the marker, or of the picked food
+	float x;
+	float y;
+	float intensity;
+	uint32_t food_slot;
+	uint64_t food_cell;
+};
+
+// Order of World::apply in a single process: colony, chunk, picked food then markers, ant
+bool isAppliedBefore(const ChangeRecord& a, const ChangeRecord& b)
+{
+	const uint32_t chunk_a = a.ant / Colony::chunk_size;
+	const uint32_t chunk_b = b.ant / Colony::chunk_size;
+	if (a.colony != b.colony) {
+		return a.colony < b.colony;
+	}
+	if (chunk_a != chunk_b) {
+		return chunk_a < chunk_b;
+	}
+	if (a.kind != b.kind) {
+		return a.kind < b.kind;
+	}
+	return a.ant < b.ant;
+}
+
+struct AntRecord
+{
+	uint32_t colony;
+	uint32_t id;
+	float values[11];
+	uint32_t phase;
+};
+
+// The float arrays of Ants, in the order of AntRecord::values
+template<typename AntsType>
+auto getColumns(AntsType& ants) -> std::array<decltype(&ants.position_x), 11>
+{
+	return {{&ants.position_x, &ants.position_y, &ants.last_direction_update, &ants.last_marker, &ants.reserve, &ants.direction.angle,
+		&ants.direction.target_angle, &ants.direction.vec_x, &ants.direction.vec_y, &ants.direction.target_x, &ants.direction.target_y}};
+}
+
+AntRecord toRecord(const Ants& ants, uint64_t i)
+{
+	AntRecord record;
+	record.colony = ants.colony;
+	record.id = ants.id[i];
+	record.phase = ants.phase[i];
+	const auto columns = getColumns(ants);
+	for (uint32_t k(0); k < columns.size(); ++k) {
+		record.values[k] = (*columns[k])[i];
+	}
+	return record;
+}
+
+void addAnt(Ants& ants, const AntRecord& record)
+{
+	const auto columns = getColumns(ants);
+	for (uint32_t k(0); k < columns.size(); ++k) {
+		columns[k]->push_back(record.values[k]);
+	}
+	ants.id.push_back(record.id);
+	ants.phase.push_back(to<uint8_t>(record.phase));
+}
+
+// Moves the last ant in place of ant i
+void removeAnt(Ants& ants, uint64_t i)
+{
+	const auto columns = getColumns(ants);
+	for (std::vector<float>* column : columns) {
+		(*column)[i] = column->back();
+		column->pop_back();
+	}
+	ants.id[i] = ants.id.back();
+	ants.id.pop_back();
+	ants.phase[i] = ants.phase.back();
+	ants.phase.pop_back();
+}
+
+void clearAnts(Ants& ants)
+{
+	for (std::vector<float>* column : getColumns(ants)) {
+		column->clear();
+	}
+	ants.id.clear();
+	ants.phase.clear();
+}
+
+// Cells of grid whose column the strip owns, as cells count, then cell records and objects
+template<typename T, typename Record>
+void writeOwnedCells(ByteWriter& writer, const Grid<T>& grid, const Strips& strips, uint32_t strip)
+{
+	std::vector<checkpoint::CellRecord> cells;
+	std::vector<Record> records;
+	grid.forEachCell([&](uint64_t cell_index, const std::vector<T>& cell) {
+		if (strips.getOwner(strips.getColumn(cell.front().position.x)) == strip) {
+			cells.push_back(checkpoint::CellRecord{cell_index, to<uint32_t>(cell.size()), 0});
+			for (const T& obj : cell) {
+				records.push_back(checkpoint::toRecord(obj));
+			}
+		}
+	});
+	writer.writeArray(cells);
+	writer.writeArray(records);
+}
+
+template<typename T, typename Record>
+void readCells(ByteReader& reader, Grid<T>& grid, uint16_t colony)
+{
+	std::vector<checkpoint::CellRecord> cells;
+	std::vector<Record> records;
+	reader.readArray(cells);
+	reader.readArray(records);
+	uint64_t record = 0;
+	for (const checkpoint::CellRecord& cell : cells) {
+		const sf::Vector2i cell_coords = grid.getCoordsFromIndex(cell.index);
+		for (uint32_t k(0); k < cell.count; ++k) {
+			grid.add(cell_coords, checkpoint::fromRecord(records[record++], colony));
+		}
+	}
+}
+
+// Drops everything the strip neither owns nor keeps as ghost
+void keepStrip(World& world, std::vector<Colony>& colonies, const Strips& strips, uint32_t strip)
+{
+	for (Grid<Marker>& grid : world.marker_grids) {
+		grid.removeIf([&](const Marker& m) { return !strips.holds(strip, strips.getColumn(m.position.x)); });
+	}
+	world.grid_food.removeIf([&](const Food& f) { return !strips.holds(strip, strips.getColumn(f.position.x)); });
+	world.rebuildIndexes();
+
+	for (Colony& colony : colonies) {
+		Ants& ants = colony.ants;
+		for (uint64_t i(ants.size()); i--;) {
+			if (strips.getOwner(strips.getColumn(ants.position_x[i])) != strip) {
+				removeAnt(ants, i);
+			}
+		}
+		colony.resizeChunks();
+	}
+}
+
+// Start of the shared memory, followed by the rings
+struct SharedState
+{
+	// Set by any process that fails, the others then stop waiting for it
+	alignas(64) std::atomic<uint32_t> failed;
+};
+
+class Worker
+{
+public:
+	Worker(World& world, std::vector<Colony>& colonies, const Strips& strips, uint32_t strip, SharedState& shared, const std::vector<Link>& links,
+		const std::vector<uint32_t>& neighbours, Link parent_link, uint32_t threads_count)
+		: m_world(world)
+		, m_colonies(colonies)
+		, m_strips(strips)
+		, m_strip(strip)
+		, m_shared(shared)
+		, m_links(links)
+		, m_neighbours(neighbours)
+		, m_parent_link(parent_link)
+		, m_thread_pool(threads_count)
+	{}
+
+	bool run(uint32_t ticks, float dt)
+	{
+		keepStrip(m_world, m_colonies, m_strips, m_strip);
+		for (uint32_t i(0); i < ticks; ++i) {
+			Colony::updateChunks(m_colonies, dt, m_world, m_thread_pool);
+			if (!applyChanges()) {
+				return false;
+			}
+			for (Colony& colony : m_colonies) {
+				++colony.tick;
+			}
+			m_world.update(dt);
+			if (!migrateAnts()) {
+				return false;
+			}
+		}
+		return sendResult();
+	}
+
+private:
+	World& m_world;
+	std::vector<Colony>& m_colonies;
+	const Strips& m_strips;
+	const uint32_t m_strip;
+	SharedState& m_shared;
+	const std::vector<Link>& m_links;
+	const std::vector<uint32_t>& m_neighbours;
+	const Link m_parent_link;
+	ThreadPool m_thread_pool;
+	Stats m_stats;
+
+	std::vector<ChangeRecord> m_changes;
+	std::vector<std::vector<ChangeRecord>> m_outgoing_changes;
+	std::vector<std::vector<AntRecord>> m_outgoing_ants;
+	std::vector<std::vector<uint8_t>> m_messages;
+	std::vector<std::vector<uint8_t>> m_received;
+
+	bool idle()
+	{
+		std::this_thread::yield();
+		return !m_shared.failed;
+	}
+
+	bool exchangeMessages()
+	{
+		for (const std::vector<uint8_t>& message : m_messages) {
+			m_stats.exchanged_bytes += message.size();
+		}
+		return exchange(m_links, m_messages, m_received, [this]() { return idle(); });
+	}
+
+	// Sends the changes landing in cells held by neighbours and applies the ones of held cells
+	bool applyChanges()
+	{
+		m_changes.clear();
+		for (const Colony& colony : m_colonies) {
+			for (const Colony::UpdateChunk& chunk : colony.chunks) {
+				const WorldChanges& changes = chunk.changes;
+				for (uint64_t k(0); k < changes.picked_food.size(); ++k) {
+					const Food& food = *changes.picked_food[k];
+					const std::vector<Food>& cell = *m_world.grid_food.getAt(food.position);
+					const uint64_t cell_index = m_world.grid_food.getIndexFromCoords(m_world.grid_food.getCellCoords(food.position));
+					m_changes.push_back(ChangeRecord{colony.id, changes.picked_food_ants[k], ChangeRecord::PickFood, 0,
+						food.position.x, food.position.y, 0.0f, to<uint32_t>(&food - cell.data()), cell_index});
+				}
+				for (uint64_t k(0); k < changes.markers.size(); ++k) {
+					const Marker& m = changes.markers[k];
+					m_changes.push_back(ChangeRecord{colony.id, changes.marker_ants[k], ChangeRecord::AddMarker, to<uint32_t>(m.type),
+						m.position.x, m.position.y, m.intensity, 0, 0});
+				}
+			}
+		}
+
+		m_outgoing_changes.resize(m_neighbours.size());
+		m_messages.resize(m_neighbours.size());
+		for (uint32_t n(0); n < m_neighbours.size(); ++n) {
+			m_outgoing_changes[n].clear();
+			for (const ChangeRecord& change : m_changes) {
+				if (m_strips.holds(m_neighbours[n], m_strips.getColumn(change.x))) {
+					m_outgoing_changes[n].push_back(change);
+				}
+			}
+			ByteWriter(m_messages[n]).writeArray(m_outgoing_changes[n]);
+		}
+		if (!exchangeMessages()) {
+			return false;
+		}
+
+		std::vector<ChangeRecord> received;
+		for (const std::vector<uint8_t>& message : m_received) {
+			ByteReader(message).readArray(received);
+			m_changes.insert(m_changes.end(), received.begin(), received.end());
+		}
+
+		std::sort(m_changes.begin(), m_changes.end(), isAppliedBefore);
+		for (const ChangeRecord& change : m_changes) {
+			if (change.kind == ChangeRecord::PickFood) {
+				m_world.pickFood((*m_world.grid_food.getCell(change.food_cell))[change.food_slot]);
+			}
+			else {
+				m_world.addMarker(Marker(sf::Vector2f(change.x, change.y), static_cast<Marker::Type>(change.marker_type), change.intensity, false, to<uint16_t>(change.colony)));
+			}
+		}
+		return true;
+	}
+
+	// Hands the ants that left the strip over to their new owner
+	bool migrateAnts()
+	{
+		m_outgoing_ants.resize(m_neighbours.size());
+		for (std::vector<AntRecord>& ants : m_outgoing_ants) {
+			ants.clear();
+		}
+
+		for (Colony& colony : m_colonies) {
+			Ants& ants = colony.ants;
+			for (uint64_t i(ants.size()); i--;) {
+				const uint32_t owner = m_strips.getOwner(m_strips.getColumn(ants.position_x[i]));
+				if (owner == m_strip) {
+					continue;
+				}
+				const auto neighbour = std::find(m_neighbours.begin(), m_neighbours.end(), owner);
+				if (neighbour == m_neighbours.end()) {
+					return false;
+				}
+				m_outgoing_ants[neighbour - m_neighbours.begin()].push_back(toRecord(ants, i));
+				removeAnt(ants, i);
+				++m_stats.migrated_ants;
+			}
+		}
+
+		for (uint32_t n(0); n < m_neighbours.size(); ++n) {
+			ByteWriter(m_messages[n]).writeArray(m_outgoing_ants[n]);
+		}
+		if (!exchangeMessages()) {
+			return false;
+		}
+
+		std::vector<AntRecord> received;
+		for (const std::vector<uint8_t>& message : m_received) {
+			ByteReader(message).readArray(received);
+			for (const AntRecord& ant : received) {
+				addAnt(m_colonies[ant.colony].ants, ant);
+			}
+		}
+		for (Colony& colony : m_colonies) {
+			colony.resizeChunks();
+		}
+		return true;
+	}
+
+	// Sends the owned ants and cells to the parent process
+	bool sendResult()
+	{
+		std::vector<std::vector<uint8_t>> message(1);
+		ByteWriter writer(message[0]);
+		writer.write(m_stats);
+
+		std::vector<AntRecord> ants;
+		for (const Colony& colony : m_colonies) {
+			for (uint64_t i(0); i < colony.ants.size(); ++i) {
+				ants.push_back(toRecord(colony.ants, i));
+			}
+		}
+		writer.writeArray(ants);
+		for (const Grid<Marker>& grid : m_world.marker_grids) {
+			writeOwnedCells<Marker, checkpoint::MarkerRecord>(writer, grid, m_strips, m_strip);
+		}
+		writeOwnedCells<Food, checkpoint::FoodRecord>(writer, m_world.grid_food, m_strips, m_strip);
+
+		std::vector<std::vector<uint8_t>> received;
+		return exchange({m_parent_link}, message, received, [this]() { return idle(); });
+	}
+};
+
+}
+
+
+bool run(World& world, std::vector<Colony>& colonies, uint32_t workers_count, uint32_t ticks, float dt, uint32_t threads_count, Stats* stats)
+{
+	// The pheromone field is not split between workers
+	if (!workers_count || colonies.size() != world.getColoniesCount() || world.field) {
+		return false;
+	}
+	// Picked food is found by its slot in its cell, which only matches between workers when a
+	// strip edge never splits a food cell
+	if (world.marker_grids.front().cell_size % world.grid_food.cell_size) {
+		return false;
+	}
+	const Strips strips(world, workers_count, getGhostColumns(world, colonies));
+	for (uint32_t i(0); i < workers_count; ++i) {
+		if (strips.first_columns[i + 1] - strips.first_columns[i] < strips.getMinStripColumns()) {
+			return false;
+		}
+	}
+	if (!threads_count) {
+		threads_count = std::max(1u, std::thread::hardware_concurrency() / workers_count);
+	}
+
+	// One ring per direction between neighbours and one from every worker to the parent,
+	// which is process workers_count
+	constexpr uint64_t ring_capacity = 1 << 20;
+	const uint64_t ring_size = sizeof(Ring) + ring_capacity;
+	std::vector<std::pair<uint32_t, uint32_t>> ring_ends;
+	for (uint32_t i(0); i < workers_count; ++i) {
+		for (uint32_t neighbour : strips.getNeighbours(i)) {
+			ring_ends.emplace_back(i, neighbour);
+		}
+		ring_ends.emplace_back(i, workers_count);
+	}
+
+	const uint64_t shared_size = sizeof(SharedState) + ring_ends.size() * ring_size;
+	void* shared_memory = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared_memory == MAP_FAILED) {
+		return false;
+	}
+	uint8_t* memory = static_cast<uint8_t*>(shared_memory);
+	SharedState& shared = *new (memory) SharedState();
+	shared.failed = 0;
+	std::vector<Ring*> rings;
+	for (uint64_t i(0); i < ring_ends.size(); ++i) {
+		rings.push_back(new (memory + sizeof(SharedState) + i * ring_size) Ring(ring_capacity));
+	}
+	const auto getRing = [&](uint32_t from, uint32_t to) -> Ring* {
+		const auto it = std::find(ring_ends.begin(), ring_ends.end(), std::make_pair(from, to));
+		return it == ring_ends.end() ? nullptr : rings[it - ring_ends.begin()];
+	};
+
+	std::vector<pid_t> workers;
+	for (uint32_t strip(0); strip < workers_count; ++strip) {
+		const pid_t pid = fork();
+		if (pid < 0) {
+			shared.failed = 1;
+			break;
+		}
+		if (!pid) {
+			const std::vector<uint32_t> neighbours = strips.getNeighbours(strip);
+			std::vector<Link> links;
+			for (uint32_t neighbour : neighbours) {
+				links.push_back(Link{getRing(strip, neighbour), getRing(neighbour, strip)});
+			}
+			Worker worker(world, colonies, strips, strip, shared, links, neighbours, Link{getRing(strip, workers_count), nullptr}, threads_count);
+			const bool success = worker.run(ticks, dt);
+			if (!success) {
+				shared.failed = 1;
+			}
+			// Nothing of the parent, its threads included, has to be cleaned up here
+			_exit(success ? 0 : 1);
+		}
+		workers.push_back(pid);
+	}
+
+	// Gathers the results while watching for workers dying without a word
+	std::vector<Link> links;
+	std::vector<std::vector<uint8_t>> no_messages(workers.size());
+	std::vector<std::vector<uint8_t>> results;
+	std::vector<bool> exited(workers.size(), false);
+	for (uint32_t i(0); i < workers.size(); ++i) {
+		links.push_back(Link{nullptr, getRing(i, workers_count)});
+	}
+	const bool gathered = !shared.failed && exchange(links, no_messages, results, [&]() {
+		std::this_thread::yield();
+		for (uint32_t i(0); i < workers.size(); ++i) {
+			int status;
+			if (!exited[i] && waitpid(workers[i], &status, WNOHANG) == workers[i]) {
+				exited[i] = true;
+				if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+					shared.failed = 1;
+				}
+			}
+		}
+		return !shared.failed;
+	});
+
+	bool success = gathered;
+	for (uint32_t i(0); i < workers.size(); ++i) {
+		int status;
+		if (!exited[i] && (waitpid(workers[i], &status, 0) != workers[i] || !WIFEXITED(status) || WEXITSTATUS(status))) {
+			success = false;
+		}
+	}
+	munmap(shared_memory, shared_size);
+	if (!success || workers.size() != workers_count) {
+		return false;
+	}
+
+	for (Grid<Marker>& grid : world.marker_grids) {
+		grid.clear();
+	}
+	world.grid_food.clear();
+	std::vector<std::vector<AntRecord>> colonies_ants(colonies.size());
+	for (const std::vector<uint8_t>& result : results) {
+		ByteReader reader(result);
+		const Stats worker_stats = reader.read<Stats>();
+		if (stats) {
+			stats->migrated_ants += worker_stats.migrated_ants;
+			stats->exchanged_bytes += worker_stats.exchanged_bytes;
+		}
+
+		std::vector<AntRecord> ants;
+		reader.readArray(ants);
+		for (const AntRecord& ant : ants) {
+			colonies_ants[ant.colony].push_back(ant);
+		}
+		for (uint32_t channel(0); channel < world.marker_grids.size(); ++channel) {
+			readCells<Marker, checkpoint::MarkerRecord>(reader, world.marker_grids[channel], to<uint16_t>(channel / 2));
+		}
+		readCells<Food, checkpoint::FoodRecord>(reader, world.grid_food, 0);
+	}
+
+	// Ants back in id order, as in a single process
+	for (Colony& colony : colonies) {
+		std::vector<AntRecord>& ants = colonies_ants[colony.id];
+		std::sort(ants.begin(), ants.end(), [](const AntRecord& a, const AntRecord& b) { return a.id < b.id; });
+		clearAnts(colony.ants);
+		for (const AntRecord& ant : ants) {
+			addAnt(colony.ants, ant);
+		}
+		colony.resizeChunks();
+		colony.tick += ticks;
+	}
+
+	world.tick += ticks;
+	world.decay_per_tick = 1.0f * dt;
+	world.rebuildIndexes();
+	return true;
+}
+
+#else
+
+bool run(World&, std::vector<Colony>&, uint32_t, uint32_t, float, uint32_t, Stats*)
+{
+	return false;
+}
+
+#endif
+
+}
@@ -2,27 +2,165 @@
 #include <vector>
 #include <list>
 #include <fstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cctype>
+#include <memory>
 #include "colony.hpp"
 #include "config.hpp"
 #include "display_manager.hpp"
+#include "simulation.hpp"
+#include "checkpoint.hpp"
+#include "trajectory.hpp"
+#include "profiler.hpp"
 
 
-uint32_t loadUserConf()
+struct UserConf
 {
 	uint32_t ants_count = 512;
+	uint64_t seed = 0;
+	uint32_t world_width = Conf::WIN_WIDTH;
+	uint32_t world_height = Conf::WIN_HEIGHT;
+	uint32_t colonies_count = 1;
+	// Ants of every colony, empty when the colonies share ants_count evenly
+	std::vector<uint32_t> colonies_ants;
+};
+
+
+// conf.txt holds the number of ants optionally followed by the random seed, the world size,
+// the number of colonies sharing the ants and the ants of each colony, which replace the number
+// of ants when all of them are given
+UserConf loadUserConf()
+{
+	UserConf conf;
 	std::ifstream conf_file("conf.txt");
 	if (conf_file) {
-		conf_file >> ants_count;
+		conf_file >> conf.ants_count;
+		if (!(conf_file >> conf.seed)) {
+			conf.seed = 0;
+		}
+		else if (!(conf_file >> conf.world_width >> conf.world_height)) {
+			conf.world_width = Conf::WIN_WIDTH;
+			conf.world_height = Conf::WIN_HEIGHT;
+		}
+		else if (!(conf_file >> conf.colonies_count) || !conf.colonies_count) {
+			conf.colonies_count = 1;
+		}
+		else {
+			uint32_t colony_ants;
+			while (conf.colonies_ants.size() < conf.colonies_count && conf_file >> colony_ants) {
+				conf.colonies_ants.push_back(colony_ants);
+			}
+			if (conf.colonies_ants.size() < conf.colonies_count) {
+				conf.colonies_ants.clear();
+			}
+		}
 	}
 	else {
 		std::cout << "Couldn't find 'conf.txt', loading default" << std::endl;
 	}
 
-	return ants_count;
+	return conf;
+}
+
+
+struct Arguments
+{
+	std::string checkpoint_path;
+	std::string record_path;
+	std::string replay_path;
+	// Phase times of every frame, as CSV
+	std::string profile_path;
+	// See World::coalesce_radius
+	float coalesce_radius = 0.0f;
+	// Texel size of the pheromone field, 0 keeps discrete markers
+	uint32_t field_texel_size = 0;
+	// Of new colonies, checkpoints keep their own
+	Directions::Mode direction_mode = Directions::Angle;
+};
+
+
+// AntSimulator [CHECKPOINT] [--record FILE] [--replay FILE] [--profile FILE] [--coalesce PIXELS] [--field [PIXELS]]
+//              [--direction angle|vector]
+Arguments parseArguments(int argc, char** argv)
+{
+	Arguments arguments;
+	for (int i(1); i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--record" && i + 1 < argc) {
+			arguments.record_path = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc) {
+			arguments.replay_path = argv[++i];
+		}
+		else if (arg == "--profile" && i + 1 < argc) {
+			arguments.profile_path = argv[++i];
+		}
+		else if (arg == "--coalesce" && i + 1 < argc) {
+			arguments.coalesce_radius = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "--direction" && i + 1 < argc) {
+			arguments.direction_mode = std::string(argv[++i]) == "vector" ? Directions::Vector : Directions::Angle;
+		}
+		else if (arg == "--field") {
+			arguments.field_texel_size = World::default_field_texel_size;
+			if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+				arguments.field_texel_size = std::max(1u, to<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+			}
+		}
+		else {
+			arguments.checkpoint_path = arg;
+		}
+	}
+	return arguments;
+}
+
+
+// Shows recorded trajectories instead of simulating, markers and food are not recorded
+int runReplay(sf::RenderWindow& window, DisplayManager& display_manager, const std::string& path)
+{
+	trajectory::Reader reader;
+	if (!reader.open(path)) {
+		std::cout << "Cannot read trajectories '" << path << "'" << std::endl;
+		return 1;
+	}
+
+	const trajectory::Header& header = reader.getHeader();
+	Colony colony(header.colony_x, header.colony_y, 0);
+	RenderSnapshot snapshot;
+	snapshot.world_size = sf::Vector2f(header.world_width, header.world_height);
+	snapshot.colony_positions.push_back(colony.position);
+	snapshot.colony_size = header.colony_size;
+	display_manager.setOffset(colony.position);
+
+	while (window.isOpen())
+	{
+		display_manager.processEvents();
+
+		if (!display_manager.pause) {
+			const uint32_t ticks = display_manager.speed_mode ? 8 : 1;
+			for (uint32_t i(0); i < ticks; ++i) {
+				if (!reader.readTick(colony.ants, snapshot.tick)) {
+					reader.rewind();
+					break;
+				}
+			}
+			colony.writeVertices(snapshot.ants, snapshot.carried_food);
+			++snapshot.version;
+		}
+
+		window.clear(sf::Color(94, 87, 87));
+		display_manager.draw(snapshot);
+		window.display();
+	}
+
+	Conf::freeTextures();
+	return 0;
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
 	sf::ContextSettings settings;
 	settings.antialiasingLevel = 8;
@@ -30,19 +168,85 @@ int main()
 	window.setFramerateLimit(60);
 
 	Conf::loadTextures();
-	const uint32_t ants_count = loadUserConf();
+	const UserConf user_conf = loadUserConf();
+
+	const Arguments arguments = parseArguments(argc, argv);
+	DisplayManager display_manager(window, window);
+	if (!arguments.replay_path.empty()) {
+		return runReplay(window, display_manager, arguments.replay_path);
+	}
+
+	checkpoint::Reader reader;
+	bool resume = !arguments.checkpoint_path.empty() && reader.open(arguments.checkpoint_path);
+	if (!arguments.checkpoint_path.empty() && !resume) {
+		std::cout << "Cannot read checkpoint '" << arguments.checkpoint_path << "', starting a new colony" << std::endl;
+	}
+
+	std::unique_ptr<World> world_storage;
+	std::vector<Colony> colonies;
+	if (resume) {
+		// Checkpoints are restored with the marker cells they were saved with
+		const checkpoint::Header& header = reader.getHeader();
+		world_storage.reset(new World(to<uint32_t>(header.world_width), to<uint32_t>(header.world_height), header.colonies_count, header.marker_cell_size));
+		colonies = reader.makeColonies();
+		if (!reader.restore(*world_storage, colonies)) {
+			std::cout << "Cannot restore checkpoint '" << arguments.checkpoint_path << "', starting a new colony" << std::endl;
+			resume = false;
+		}
+		// Checkpoints hold discrete markers
+		else if (arguments.field_texel_size) {
+			std::cout << "Checkpoints use discrete markers, ignoring --field" << std::endl;
+		}
+	}
+	if (!resume) {
+		world_storage.reset(new World(user_conf.world_width, user_conf.world_height, user_conf.colonies_count));
+		if (arguments.field_texel_size) {
+			world_storage->useField(arguments.field_texel_size);
+		}
+		const sf::Vector2f center(to<float>(user_conf.world_width / 2), to<float>(user_conf.world_height / 2));
+		const float ring_radius = 0.35f * to<float>(std::min(user_conf.world_width, user_conf.world_height));
+		AntParameters ant_parameters;
+		ant_parameters.direction_mode = arguments.direction_mode;
+		colonies = user_conf.colonies_ants.empty() ? makeColonies(user_conf.colonies_count, user_conf.ants_count, center, ring_radius, user_conf.seed, ant_parameters)
+			: makeColonies(user_conf.colonies_ants, center, ring_radius, user_conf.seed, ant_parameters);
+		for (const Colony& colony : colonies) {
+			world_storage->addMarker(Marker(colony.position, Marker::ToHome, 10.0f, true, colony.id));
+		}
+	}
+	World& world = *world_storage;
+	world.coalesce_radius = arguments.coalesce_radius;
+	display_manager.setOffset(colonies.front().position);
 
-	World world(Conf::WIN_WIDTH, Conf::WIN_HEIGHT);
-	Colony colony(Conf::WIN_WIDTH/2, Conf::WIN_HEIGHT/2, ants_count);
-	world.addMarker(Marker(colony.position, Marker::ToHome, 10.0f, true));
-	
-	DisplayManager display_manager(window, window, world, colony);
+	trajectory::Recorder recorder;
+	if (!arguments.record_path.empty() && !recorder.open(arguments.record_path, world, colonies.front())) {
+		std::cout << "Cannot write trajectories '" << arguments.record_path << "'" << std::endl;
+	}
+
+	// From here the world belongs to the simulation thread
+	const float dt = 0.016f;
+	Simulation simulation(world, colonies, dt);
+	if (!arguments.record_path.empty()) {
+		simulation.setRecorder(&recorder);
+	}
+	simulation.start();
+
+	Profiler profiler;
+	if (!arguments.profile_path.empty() && !profiler.openCsv(arguments.profile_path)) {
+		std::cout << "Cannot write profile '" << arguments.profile_path << "'" << std::endl;
+	}
 
 	sf::Vector2f last_clic;
 
 	while (window.isOpen())
 	{
-		display_manager.processEvents();
+		const auto frame_start = std::chrono::steady_clock::now();
+		PhaseTimes frame_times;
+		{
+			ScopedTimer timer(&frame_times, PhaseTimes::ProcessEvents);
+			display_manager.processEvents();
+		}
+		simulation.setPause(display_manager.pause);
+		simulation.setSpeedMode(display_manager.speed_mode);
 
 		// Add food on clic
 		if (display_manager.clic) {
@@ -50,23 +254,61 @@ int main()
 			const sf::Vector2f world_position = display_manager.displayCoordToWorldCoord(sf::Vector2f(to<float>(mouse_position.x), to<float>(mouse_position.y)));
 			const float clic_min_dist = 2.0f;
 			if (getLength(world_position - last_clic) > clic_min_dist) {
-				world.addFoodAt(world_position.x, world_position.y, 5.0f);
+				simulation.post([&world, world_position]() { world.addFoodAt(world_position.x, world_position.y, 5.0f); });
 				last_clic = world_position;
 			}
 		}
 
-		const float dt = 0.016f;
+		if (display_manager.save_checkpoint) {
+			simulation.post([&world, &colonies]() {
+				if (world.field) {
+					std::cout << "Checkpoints cannot hold the pheromone field" << std::endl;
+				}
+				else if (!checkpoint::save("checkpoint.bin", world, colonies)) {
+					std::cout << "Cannot write 'checkpoint.bin'" << std::endl;
+				}
+			});
+			display_manager.save_checkpoint = false;
+		}
 
-		if (!display_manager.pause) {
-			colony.update(dt, world);
-			world.update(dt);
+		if (display_manager.switch_steering) {
+			simulation.post([&world, &colonies]() {
+				world.useMarkerRaster();
+				for (Colony& colony : colonies) {
+					AntParameters& parameters = colony.ants.parameters;
+					parameters.steering = parameters.steering == AntParameters::Sensors ? AntParameters::Centroid : AntParameters::Sensors;
+				}
+				std::cout << "Steering: " << (colonies.front().ants.parameters.steering == AntParameters::Sensors ? "sensors" : "centroid") << std::endl;
+			});
+			display_manager.switch_steering = false;
 		}
 
-		window.clear(sf::Color(94, 87, 87));
-		
-		display_manager.draw();
+		if (simulation.acquireSnapshot()) {
+			frame_times.add(simulation.getSnapshot().phase_times);
+		}
 
-		window.display();
+		{
+			ScopedTimer timer(&frame_times, PhaseTimes::Draw);
+			window.clear(sf::Color(94, 87, 87));
+			display_manager.draw(simulation.getSnapshot());
+			if (display_manager.debug_mode) {
+				display_manager.drawProfiler(profiler);
+			}
+		}
+
+		{
+			ScopedTimer timer(&frame_times, PhaseTimes::Display);
+			window.display();
+		}
+
+		frame_times.ms[PhaseTimes::Frame] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+		profiler.addFrame(frame_times);
+	}
+
+	simulation.stop();
+	recorder.close();
+	if (recorder.getDroppedChunks()) {
+		std::cout << recorder.getDroppedChunks() << " trajectory chunks dropped, the disk was too slow" << std::endl;
 	}
 
 	// Free textures
@@ -0,0 +1,155 @@
+#include "simulation.hpp"
+#include <chrono>
+
+
+Simulation::Simulation(World& world, std::vector<Colony>& colonies, float dt, uint32_t threads_count)
+	: m_world(world)
+	, m_colonies(colonies)
+	, m_thread_pool(threads_count)
+	, m_dt(dt)
+	, m_recorder(nullptr)
+	, m_running(false)
+	, m_pause(false)
+	, m_speed_mode(false)
+	, m_ticks_per_second(0.0f)
+	, m_back(new RenderSnapshot())
+	, m_ready(new RenderSnapshot())
+	, m_front(new RenderSnapshot())
+	, m_ready_available(false)
+	, m_snapshot_requested(true)
+	, m_version(0)
+{
+}
+
+Simulation::~Simulation()
+{
+	stop();
+}
+
+void Simulation::start()
+{
+	if (m_running) {
+		return;
+	}
+	m_running = true;
+	m_thread = std::thread([this]() { run(); });
+}
+
+void Simulation::stop()
+{
+	m_running = false;
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+void Simulation::post(const std::function<void()>& command)
+{
+	std::lock_guard<std::mutex> lock(m_commands_mutex);
+	m_commands.push_back(command);
+}
+
+bool Simulation::acquireSnapshot()
+{
+	std::lock_guard<std::mutex> lock(m_snapshot_mutex);
+	if (!m_ready_available) {
+		return false;
+	}
+	std::swap(m_ready, m_front);
+	m_ready_available = false;
+	m_snapshot_requested = true;
+	return true;
+}
+
+void Simulation::run()
+{
+	using Clock = std::chrono::steady_clock;
+	const Clock::duration tick_duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(m_dt));
+	// Real time is given up instead of running many ticks in a row to catch up
+	const Clock::duration max_lateness = 10 * tick_duration;
+
+	Clock::time_point next_tick = Clock::now();
+	Clock::time_point rate_start = next_tick;
+	uint32_t rate_ticks = 0;
+
+	while (m_running) {
+		runCommands();
+
+		const bool pause = m_pause;
+		if (!pause) {
+			Colony::updateAll(m_colonies, m_dt, m_world, m_thread_pool, &m_phase_times);
+			m_world.update(m_dt, &m_phase_times, &m_thread_pool);
+			++m_phase_times.ticks;
+			if (m_recorder) {
+				m_recorder->record(m_colonies.front().ants, m_world.tick);
+			}
+			++rate_ticks;
+		}
+
+		if (m_snapshot_requested) {
+			publish();
+		}
+
+		const Clock::time_point now = Clock::now();
+		if (now - rate_start > std::chrono::seconds(1)) {
+			m_ticks_per_second = rate_ticks / std::chrono::duration<float>(now - rate_start).count();
+			rate_start = now;
+			rate_ticks = 0;
+		}
+
+		if (pause || !m_speed_mode) {
+			next_tick += tick_duration;
+			if (now - next_tick > max_lateness) {
+				next_tick = now;
+			}
+			std::this_thread::sleep_until(next_tick);
+		}
+		else {
+			next_tick = now;
+		}
+	}
+}
+
+void Simulation::runCommands()
+{
+	std::vector<std::function<void()>> commands;
+	{
+		std::lock_guard<std::mutex> lock(m_commands_mutex);
+		commands.swap(m_commands);
+	}
+
+	for (const std::function<void()>& command : commands) {
+		command();
+	}
+}
+
+void Simulation::publish()
+{
+	RenderSnapshot& snapshot = *m_back;
+	{
+		ScopedTimer timer(&m_phase_times, PhaseTimes::VertexGeneration);
+		Colony::writeVertices(m_colonies, snapshot.ants, snapshot.carried_food);
+		m_world.writeFoodVertices(snapshot.food);
+		m_world.marker_vertices.flush(snapshot.markers);
+		if (m_world.field) {
+			m_world.writeFieldPixels(snapshot.field_pixels);
+			snapshot.field_size = sf::Vector2u(m_world.field->width, m_world.field->height);
+			snapshot.field_texel_size = m_world.field->texel_size;
+		}
+	}
+	snapshot.phase_times = m_phase_times;
+	m_phase_times.clear();
+	snapshot.world_size = m_world.size;
+	snapshot.colony_positions.clear();
+	for (const Colony& colony : m_colonies) {
+		snapshot.colony_positions.push_back(colony.position);
+	}
+	snapshot.colony_size = m_colonies.front().size;
+	snapshot.tick = m_world.tick;
+	snapshot.version = ++m_version;
+
+	std::lock_guard<std::mutex> lock(m_snapshot_mutex);
+	std::swap(m_back, m_ready);
+	m_ready_available = true;
+	m_snapshot_requested = false;
+}
@@ -0,0 +1,80 @@
+#include "thread_pool.hpp"
+
+
+ThreadPool::ThreadPool(uint32_t threads_count)
+	: m_job(nullptr)
+	, m_next_index(0)
+	, m_count(0)
+	, m_active_workers(0)
+	, m_generation(0)
+	, m_stop(false)
+{
+	if (!threads_count) {
+		threads_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (uint32_t i(1); i < threads_count; ++i) {
+		m_workers.emplace_back([this]() { workerLoop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start_cv.notify_all();
+
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::run(uint32_t count, const std::function<void(uint32_t)>& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_next_index = 0;
+		m_active_workers = static_cast<uint32_t>(m_workers.size());
+		++m_generation;
+	}
+	m_start_cv.notify_all();
+
+	runJobs();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this]() { return m_active_workers == 0; });
+	m_job = nullptr;
+}
+
+void ThreadPool::runJobs()
+{
+	for (uint32_t i = m_next_index++; i < m_count; i = m_next_index++) {
+		(*m_job)(i);
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	uint64_t last_generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start_cv.wait(lock, [&]() { return m_stop || m_generation != last_generation; });
+			if (m_stop) {
+				return;
+			}
+			last_generation = m_generation;
+		}
+
+		runJobs();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_active_workers == 0) {
+			m_done_cv.notify_one();
+		}
+	}
+}
@@ -0,0 +1,367 @@
+#include "trajectory.hpp"
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+
+namespace trajectory
+{
+
+namespace
+{
+
+uint32_t zigzag(int32_t v)
+{
+	return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+int32_t unzigzag(uint32_t v)
+{
+	return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+void writeVarint(uint8_t*& out, uint32_t v)
+{
+	while (v >= 0x80) {
+		*(out++) = static_cast<uint8_t>(v | 0x80);
+		v >>= 7;
+	}
+	*(out++) = static_cast<uint8_t>(v);
+}
+
+// Returns false when the varint does not end before end or does not fit in 32 bits
+bool readVarint(const uint8_t*& in, const uint8_t* end, uint32_t& v)
+{
+	v = 0;
+	for (uint32_t shift(0); shift < 32; shift += 7) {
+		if (in == end) {
+			return false;
+		}
+		const uint8_t byte = *(in++);
+		v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Diamond angle of v in [0, 4) scaled to a byte, monotonic with the actual angle
+uint8_t encodeHeading(float x, float y)
+{
+	const float sum = std::abs(x) + std::abs(y);
+	if (!sum) {
+		return 0;
+	}
+	const float inv_sum = 1.0f / sum;
+	float a;
+	if (y >= 0.0f) {
+		a = x >= 0.0f ? y * inv_sum : 1.0f - x * inv_sum;
+	}
+	else {
+		a = x < 0.0f ? 2.0f - y * inv_sum : 3.0f + x * inv_sum;
+	}
+	return static_cast<uint8_t>(to<int32_t>(a * 64.0f + 0.5f) & 0xFF);
+}
+
+sf::Vector2f decodeHeading(uint8_t heading)
+{
+	const float a = to<float>(heading) / 64.0f;
+	const sf::Vector2f v(a < 2.0f ? 1.0f - a : a - 3.0f, a < 3.0f ? (a > 1.0f ? 2.0f - a : a) : a - 4.0f);
+	return v / getLength(v);
+}
+
+// Positions are never negative, the world wraps them in [0, size]
+int32_t quantize(float f, float inv_step)
+{
+	return to<int32_t>(f * inv_step + 0.5f);
+}
+
+}
+
+
+Recorder::Recorder()
+	: m_max_queued_chunks(0)
+	, m_last_tick(0)
+	, m_stop(false)
+	, m_dropped_chunks(0)
+	, m_written_bytes(0)
+{}
+
+Recorder::~Recorder()
+{
+	close();
+}
+
+bool Recorder::open(const std::string& path, const World& world, const Colony& colony, uint32_t ticks_per_chunk, uint32_t max_queued_chunks)
+{
+	close();
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file) {
+		return false;
+	}
+
+	std::memset(&m_header, 0, sizeof(m_header));
+	std::memcpy(m_header.magic, magic, sizeof(magic));
+	m_header.version = version;
+	m_header.ants_count = to<uint32_t>(colony.ants.size());
+	m_header.world_width = world.size.x;
+	m_header.world_height = world.size.y;
+	m_header.colony_x = colony.position.x;
+	m_header.colony_y = colony.position.y;
+	m_header.colony_size = colony.size;
+	m_header.position_step = 1.0f / 16.0f;
+	m_header.ticks_per_chunk = std::max(1u, ticks_per_chunk);
+	m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_written_bytes = sizeof(m_header);
+
+	m_max_queued_chunks = std::max(1u, max_queued_chunks);
+	m_last_x.assign(m_header.ants_count, 0);
+	m_last_y.assign(m_header.ants_count, 0);
+	m_chunk.header = ChunkHeader{0, 0, 0, 0};
+	m_chunk.payload.clear();
+	m_dropped_chunks = 0;
+	m_stop = false;
+	m_writer = std::thread([this]() { writerLoop(); });
+	return true;
+}
+
+void Recorder::close()
+{
+	if (!m_writer.joinable()) {
+		return;
+	}
+
+	if (m_chunk.header.ticks_count) {
+		// The last chunk is kept even if the queue is full, close can wait
+		m_max_queued_chunks = std::numeric_limits<uint32_t>::max();
+		submitChunk();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_one();
+	m_writer.join();
+	m_file.close();
+}
+
+void Recorder::record(const Ants& ants, uint32_t tick)
+{
+	const uint64_t ants_count = ants.size();
+	if (!m_writer.joinable() || ants_count != m_header.ants_count) {
+		return;
+	}
+
+	const bool keyframe = !m_chunk.header.ticks_count;
+	if (keyframe) {
+		m_chunk.header.first_tick = tick;
+		m_last_tick = tick;
+		std::fill(m_last_x.begin(), m_last_x.end(), 0);
+		std::fill(m_last_y.begin(), m_last_y.end(), 0);
+	}
+
+	// Room for the largest possible encoding of the tick, shrunk once written
+	std::vector<uint8_t>& payload = m_chunk.payload;
+	const uint64_t bitmap_size = (ants_count + 7) / 8;
+	const uint64_t start = payload.size();
+	payload.resize(start + 5 + 11 * ants_count + bitmap_size);
+	uint8_t* out = &payload[start];
+
+	writeVarint(out, tick - m_last_tick);
+	const float inv_step = 1.0f / m_header.position_step;
+	for (uint64_t i(0); i < ants_count; ++i) {
+		const int32_t x = quantize(ants.position_x[i], inv_step);
+		const int32_t y = quantize(ants.position_y[i], inv_step);
+		writeVarint(out, zigzag(x - m_last_x[i]));
+		writeVarint(out, zigzag(y - m_last_y[i]));
+		m_last_x[i] = x;
+		m_last_y[i] = y;
+		*(out++) = encodeHeading(ants.direction.vec_x[i], ants.direction.vec_y[i]);
+	}
+
+	std::memset(out, 0, bitmap_size);
+	for (uint64_t i(0); i < ants_count; ++i) {
+		out[i >> 3] |= static_cast<uint8_t>((ants.phase[i] == Marker::ToHome) << (i & 7));
+	}
+	out += bitmap_size;
+	payload.resize(out - payload.data());
+
+	m_last_tick = tick;
+	if (++m_chunk.header.ticks_count == m_header.ticks_per_chunk) {
+		submitChunk();
+	}
+}
+
+void Recorder::submitChunk()
+{
+	m_chunk.header.payload_size = to<uint32_t>(m_chunk.payload.size());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_queue.size() < m_max_queued_chunks) {
+			m_queue.push_back(std::move(m_chunk));
+			m_chunk.payload.clear();
+			if (!m_free_payloads.empty()) {
+				m_chunk.payload.swap(m_free_payloads.back());
+				m_free_payloads.pop_back();
+			}
+		}
+		else {
+			++m_dropped_chunks;
+		}
+	}
+	m_cv.notify_one();
+
+	m_chunk.header = ChunkHeader{0, 0, 0, 0};
+	m_chunk.payload.clear();
+}
+
+void Recorder::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty()) {
+			return;
+		}
+
+		Chunk chunk = std::move(m_queue.front());
+		m_queue.pop_front();
+		lock.unlock();
+
+		m_file.write(reinterpret_cast<const char*>(&chunk.header), sizeof(chunk.header));
+		m_file.write(reinterpret_cast<const char*>(chunk.payload.data()), chunk.payload.size());
+		m_written_bytes += sizeof(chunk.header) + chunk.payload.size();
+
+		lock.lock();
+		chunk.payload.clear();
+		m_free_payloads.push_back(std::move(chunk.payload));
+	}
+}
+
+
+bool Reader::open(const std::string& path)
+{
+	m_file.open(path, std::ios::binary);
+	m_file.seekg(0, std::ios::end);
+	const std::streamoff file_size = m_file.tellg();
+	m_file.seekg(0);
+	if (!m_file || file_size < 0) {
+		return false;
+	}
+	m_file_size = to<uint64_t>(file_size);
+
+	m_file.read(reinterpret_cast<char*>(&m_header), sizeof(m_header));
+	if (!m_file || std::memcmp(m_header.magic, magic, sizeof(magic)) || m_header.version != version) {
+		return false;
+	}
+
+	rewind();
+	return true;
+}
+
+void Reader::rewind()
+{
+	m_file.clear();
+	m_file.seekg(sizeof(Header));
+	m_chunk = ChunkHeader{0, 0, 0, 0};
+	m_chunk_tick = 0;
+	m_tick = 0;
+	m_offset = 0;
+	m_x.assign(m_header.ants_count, 0);
+	m_y.assign(m_header.ants_count, 0);
+}
+
+bool Reader::readChunk()
+{
+	m_file.read(reinterpret_cast<char*>(&m_chunk), sizeof(m_chunk));
+	// Every tick holds at least its tick delta, one byte per coordinate and heading and the phases
+	const uint64_t min_tick_size = 1 + 3 * to<uint64_t>(m_header.ants_count) + (to<uint64_t>(m_header.ants_count) + 7) / 8;
+	if (!m_file || !m_chunk.ticks_count || m_chunk.payload_size / m_chunk.ticks_count < min_tick_size) {
+		m_chunk = ChunkHeader{0, 0, 0, 0};
+		return false;
+	}
+	// The payload cannot be larger than the rest of the file, corrupt sizes are not allocated
+	const std::streamoff position = m_file.tellg();
+	if (position < 0 || m_chunk.payload_size > m_file_size - std::min(to<uint64_t>(position), m_file_size)) {
+		m_chunk = ChunkHeader{0, 0, 0, 0};
+		return false;
+	}
+
+	m_payload.resize(m_chunk.payload_size);
+	m_file.read(reinterpret_cast<char*>(m_payload.data()), m_payload.size());
+	m_chunk_tick = 0;
+	m_offset = 0;
+	std::fill(m_x.begin(), m_x.end(), 0);
+	std::fill(m_y.begin(), m_y.end(), 0);
+	if (!m_file) {
+		m_chunk = ChunkHeader{0, 0, 0, 0};
+		return false;
+	}
+	return true;
+}
+
+bool Reader::readTick(Ants& ants, uint32_t& tick)
+{
+	if (m_chunk_tick == m_chunk.ticks_count && !readChunk()) {
+		return false;
+	}
+
+	const uint64_t ants_count = m_header.ants_count;
+	if (ants.size() != ants_count) {
+		ants.position_x.resize(ants_count);
+		ants.position_y.resize(ants_count);
+		ants.direction.vec_x.resize(ants_count);
+		ants.direction.vec_y.resize(ants_count);
+		ants.phase.resize(ants_count);
+		ants.id.resize(ants_count);
+		for (uint64_t i(0); i < ants_count; ++i) {
+			ants.id[i] = to<uint32_t>(i);
+		}
+	}
+
+	// A chunk whose data runs out is skipped, the next tick is read from the next chunk
+	const uint8_t* in = m_payload.data() + m_offset;
+	const uint8_t* end = m_payload.data() + m_payload.size();
+	const auto fail = [this]() {
+		m_chunk_tick = m_chunk.ticks_count;
+		return false;
+	};
+
+	uint32_t tick_delta;
+	if (!readVarint(in, end, tick_delta)) {
+		return fail();
+	}
+	m_tick = m_chunk_tick ? m_tick + tick_delta : m_chunk.first_tick;
+	tick = m_tick;
+
+	for (uint64_t i(0); i < ants_count; ++i) {
+		uint32_t dx, dy;
+		if (!readVarint(in, end, dx) || !readVarint(in, end, dy) || in == end) {
+			return fail();
+		}
+		m_x[i] += unzigzag(dx);
+		m_y[i] += unzigzag(dy);
+		ants.position_x[i] = to<float>(m_x[i]) * m_header.position_step;
+		ants.position_y[i] = to<float>(m_y[i]) * m_header.position_step;
+		const sf::Vector2f heading = decodeHeading(*(in++));
+		ants.direction.vec_x[i] = heading.x;
+		ants.direction.vec_y[i] = heading.y;
+	}
+
+	if (to<uint64_t>(end - in) < (ants_count + 7) / 8) {
+		return fail();
+	}
+	for (uint64_t i(0); i < ants_count; ++i) {
+		ants.phase[i] = (in[i >> 3] >> (i & 7)) & 1 ? Marker::ToHome : Marker::ToFood;
+	}
+	in += (ants_count + 7) / 8;
+
+	m_offset = in - m_payload.data();
+	++m_chunk_tick;
+	return true;
+}
+
+}
@@ -1,20 +1,4 @@
 #include "utils.hpp"
-#include <random>
-
-std::random_device rd();
-std::mt19937 gen(0);
-
-float getRandRange(float width)
-{
-	std::uniform_real_distribution<float> distr(-width, width);
-	return distr(gen);
-}
-
-float getRandUnder(float width)
-{
-	std::uniform_real_distribution<float> distr(0.0f, width);
-	return distr(gen);
-}
 
 
 float getAngle(const sf::Vector2f & v)
@@ -32,3 +16,21 @@ float sign(const float f)
 {
 	return f < 0.0f ? -1.0f : 1.0f;
 }
+
+void setCircleQuad(sf::Vertex* quad, const sf::Vector2f& center, float radius, const sf::Color& color)
+{
+	constexpr float tex_size = 512.0f;
+	quad[0].position = center + sf::Vector2f(-radius, -radius);
+	quad[1].position = center + sf::Vector2f(radius, -radius);
+	quad[2].position = center + sf::Vector2f(radius, radius);
+	quad[3].position = center + sf::Vector2f(-radius, radius);
+
+	quad[0].texCoords = sf::Vector2f(0.0f, 0.0f);
+	quad[1].texCoords = sf::Vector2f(tex_size, 0.0f);
+	quad[2].texCoords = sf::Vector2f(tex_size, tex_size);
+	quad[3].texCoords = sf::Vector2f(0.0f, tex_size);
+
+	for (uint64_t i(0); i < 4; ++i) {
+		quad[i].color = color;
+	}
+}